@@ -1,38 +1,192 @@
 #include <Arduino.h>
 #include <WiFi.h>
 #include <WiFiUdp.h>
-#include <NTPClient.h>
 #include <FastLED.h>
-#include <hardware/rtc.h>
 #include <pico/util/datetime.h>
 #include <WebServer.h>
 #include <DNSServer.h>
 #include <EEPROM.h>
+#include <LittleFS.h>
+#include <hardware/pio.h>
+#include <hardware/dma.h>
+#include <hardware/clocks.h>
+#include <hardware/irq.h>
+#include <hardware/adc.h>
+#include <hardware/flash.h>
+#include <hardware/watchdog.h>
+#include <lwip/dns.h>
+#include <pico/cyw43_arch.h>
+#include <atomic>
+#include <ArduinoJson.h>
+#include <Updater.h>
+#include <PicoOTA.h>
+#include <LEAmDNS.h>
+#include <bearssl/bearssl.h>
+#include <pico/unique_id.h>
+#include "wordclock_core.h"
 
 // ==================== HARDWARE CONFIGURATION ====================
 #define LED_PIN     16
-#define NUM_LEDS    56
+#define NUM_LEDS    56               // LEDs on the built-in face
+#define MAX_LEDS    64               // Buffer size; a layout file may use up to this many
 #define BRIGHTNESS  64
-#define LED_TYPE    WS2812B
-#define COLOR_ORDER GRB
+#define LED_CORRECTION TypicalLEDStrip
 #define BRIGHTNESS_PIN 28
+#define BRIGHTNESS_ADC_INPUT 2       // GPIO28 = ADC2
 #define CONFIG_BUTTON_PIN 15
+#define POWER_BUDGET_MA 1000         // Supply current the LEDs may draw in total
+#define WS2812_CHANNEL_MA 12         // One colour channel fully on
+#define WS2812_IDLE_UA 600           // Per LED, drawn even when dark
 
 // ==================== CONFIGURATION CONSTANTS ====================
 #define AP_SSID "WordClock-Setup"
 #define AP_PASSWORD "Wordclock"
 #define DNS_PORT 53
 #define WEB_PORT 80
+#define HTTP_CHUNK_SIZE 512          // Response buffer, the only per-request RAM
+#define API_STATUS_CAPACITY 512      // StaticJsonDocument sizes, on the stack
+#define API_CONFIG_CAPACITY 768
+#define API_SCAN_CAPACITY 640        // Ten networks, SSIDs stored as pointers
+#define API_SCAN_LIMIT 10
+#define WEB_ASSET_DIR "/www/"        // LittleFS, packed from web/ by tools/build_web.py
+#define METRICS_BUCKETS 10           // Histogram buckets, bounds 16 us * 4^i
+#define METRICS_ROUTES_MAX 16        // Web routes with their own latency histogram
+#define TRACE_PORT Serial            // USB CDC; Serial1 for the UART on GP0/GP1
+#define TRACE_BAUD 921600            // Only matters for a UART port
+#define TRACE_RING_BITS 8            // 256 events per core
+#define LOG_RING_BITS 11             // 2 KB of text log waiting for the port
+#define LOG_LINE_MAX 160
+#define TRACE_LEVEL_DEFAULT 1        // 0 off, 1 events, 2 also every frame
+#define WEB_USER "admin"             // Basic auth on the LAN, password is the WiFi one
+#define MDNS_HOSTNAME "wordclock"    // http://wordclock.local
+#define OTA_TRIAL_FILE "/ota/trial"  // Present while a new image is unconfirmed
+#define OTA_ROLLBACK_FILE "/ota/rollback.bin"
+#define OTA_TRIAL_BOOTS 3            // Unconfirmed boots before rolling back
+#define OTA_CONFIRM_MS 120000        // Healthy uptime that confirms a new image
+#define OTA_FLIP_GUARD_US 30000      // No flash writes this close before a minute flip
+#define OTA_HOLD_BYTES 8192          // Upload data held in RAM across a minute flip
+#define OTA_WATCHDOG_MS 5000         // Reboot an unconfirmed image that stops running the loop
+#define RESTART_DELAY_MS 500         // Lets the reply go out before a requested restart
+#define OTA_COPY_CHUNK 1024          // Rollback copy per scheduler step
+#define OTA_COPY_STEP_US 20000       // Gap between copy steps, so the loop keeps serving
 #define BUTTON_HOLD_TIME 3000
-#define NTP_SYNC_INTERVAL 3600000    // 1 hour
+#define BUTTON_DEBOUNCE 50
+#define NETWORK_POLL_US 100000       // Fallback network poll; packets wake the core themselves
+#define WIFI_POLL_US 100000          // Link state check
+#define SCAN_POLL_US 250000
+#define ANIMATION_STEP_US 100000     // Config mode pulse
+#define HOUSEKEEPING_US 1000000      // Clock snapshot, OTA confirmation
+#define TRACE_DRAIN_US 10000         // Trace drain while output is backed up
+#define TRACE_IDLE_US 250000         // Pickup of core 1 events while tracing
+#define TASK_LATE_US 5000            // Start this far past the deadline counts as late
+#define SCAN_REFRESH_INTERVAL 30000  // Background WiFi scan period in config mode
+#define SCAN_MAX_RESULTS 16
+#define NTP_INTERVAL_MIN 900000      // 15 minutes, until the drift is known
+#define NTP_INTERVAL_MAX 28800000     // 8 hours once it is stable
+#define NTP_TARGET_ERROR_US 50000    // Residual error that still allows a longer interval
 #define WIFI_TIMEOUT 15000           // 15 seconds
+#define TZ_DEFAULT "CET-1CEST,M3.5.0,M10.5.0/3"
+#define WIFI_RETRY_MIN 1000          // First reconnect after link loss
+#define WIFI_RETRY_MAX 120000        // Backoff cap (2 minutes)
+#define NTP_PORT 123
+#define NTP_LOCAL_PORT 1337
+#define NTP_PACKET_SIZE 48
+#define NTP_DNS_TIMEOUT 5000
+#define NTP_RESPONSE_TIMEOUT 1000
+#define NTP_RETRY_MIN 2000           // First retry after a failed sync
+#define NTP_RETRY_MAX 300000         // Backoff cap (5 minutes)
+#define NTP_UNIX_OFFSET 2208988800UL // 1900 -> 1970
+#define NTP_MAX_DELAY_US 500000      // Slower round trips are too asymmetric to trust
+#define CLOCK_STEP_LIMIT_US 1000000  // Larger NTP corrections step, smaller ones slew
+#define CLOCK_SLEW_PPM 500
+#define CLOCK_DRIFT_MIN_INTERVAL 600000000LL  // Shorter sync gaps say too little about drift
+#define LAN_TIME_GROUP IPAddress(239, 255, 77, 67)   // Site-local multicast
+#define LAN_TIME_PORT 4367
+#define LAN_BEACON_INTERVAL 2000     // Leader beacon period (ms)
+#define LAN_LEADER_TIMEOUT 7000      // Silence before a follower takes over (ms)
+#define LAN_ELECTION_JITTER 3000     // Random extra wait, so not everyone takes over at once
+#define LAN_SAMPLE_WINDOW 8          // Beacons per clock correction
+#define LAN_LATENCY_US 1500          // Typical one-way delay of the best beacon
+#define LAN_MAX_OFFSET_US 5000000LL  // Larger offsets on a synced clock are replays
+#define LAN_MAC_BYTES 16             // Truncated HMAC-SHA256
+#define AMBIENT_SAMPLE_RATE 1000     // ADC samples per second
+#define AMBIENT_RING_BITS 7          // 2^7 bytes = 64 samples
+#define AMBIENT_FILTER_INTERVAL 100  // Filter update period (ms)
+#define AMBIENT_IIR_SHIFT 3          // IIR weight 1/8
+#define BRIGHTNESS_HYSTERESIS 6      // Minimum brightness step to apply
+#define TRANSITION_FPS 50
+#define TRANSITION_FRAME_US (1000000 / TRANSITION_FPS)
+#define TRANSITION_BUDGET_US 2000    // Render time allowed per transition frame
+#define TRANSITION_DEFAULT_MS 800
+#define TRANSITION_MAX_MS 5000
+#define DISPLAY_LATENCY_US 2000      // Core 1 poll plus one strip transfer
+#define WS2812_FREQ 800000
+#define WS2812_LATCH_US 600          // FIFO drain + >280us reset low
+#define WS2812_GAMMA 2.2f
+#define WS2812_DITHER_HZ 400         // Refresh rate while fractional levels are shown
+#define WS2812_DITHER_US (1000000 / WS2812_DITHER_HZ)
 
-// ==================== EEPROM CONFIGURATION ====================
+// ==================== CONFIG STORAGE ====================
+// 1 only ever lived in EEPROM, 2 is the journal record
+#define CONFIG_VERSION 2
+
+#define CRC_DMA_MIN_BYTES 256        // Below this the software loop is quicker than DMA setup
+
+#define JOURNAL_SECTORS 4
+#define JOURNAL_SLOT_SIZE 512        // Two flash pages per record
+#define JOURNAL_MAGIC 0x4C4A4357     // "WCJL"
+#define CLOCK_JOURNAL_SECTORS 2      // Time snapshots, just below the config journal
+#define CLOCK_JOURNAL_SLOT_SIZE 256
+#define CLOCK_SNAPSHOT_VERSION 1
+#define CLOCK_SCRATCH_MAGIC 0x4B4C4357   // "WCLK" in watchdog scratch 0
+#define CLOCK_SNAPSHOT_INTERVAL 900000   // 15 min: one sector erase every 4 hours
+
+// Legacy EEPROM location, read once to migrate
 #define EEPROM_SIZE 512
 #define CONFIG_ADDRESS 0
-#define CONFIG_VERSION 1
 
+// Journal payload for CONFIG_VERSION
 struct ConfigData {
+    char ssid[64];
+    char password[128];
+    char ntpServer[64];
+    char timezone[48];      // POSIX TZ rule
+    int brightness;
+    uint16_t transitionMs;
+    bool configured;
+    uint8_t transitionStyle;
+    uint8_t flags;          // CONFIG_FLAG_*
+};
+
+#define CONFIG_FLAG_LAN_TIME 0x01
+
+struct JournalHeader {
+    uint32_t magic;
+    uint32_t sequence;      // Highest valid one is the current config
+    uint16_t version;       // CONFIG_VERSION of the payload
+    uint16_t length;        // Payload bytes after the header
+    uint32_t crc;           // CRC32 of the header up to here and the payload
+};
+
+static_assert(sizeof(JournalHeader) + sizeof(ConfigData) <= JOURNAL_SLOT_SIZE, "config record fits a slot");
+
+// Last known time, restored at boot until NTP confirms it
+struct ClockSnapshot {
+    int64_t utcUs;
+    int32_t driftPpb;       // Measured crystal error, timer fast if positive
+    uint32_t flags;
+};
+
+static_assert(sizeof(JournalHeader) + sizeof(ClockSnapshot) <= CLOCK_JOURNAL_SLOT_SIZE, "snapshot fits a slot");
+
+// Current version in EEPROM, only written when the journal is unusable
+struct EepromConfig {
+    ConfigData data;
+    uint32_t checksum;
+};
+
+// Layout before the timezone rule, migrated on load
+struct ConfigDataV1 {
     char ssid[64];
     char password[128];
     char ntpServer[64];
@@ -45,770 +199,3616 @@ struct ConfigData {
 
 // ==================== GLOBAL VARIABLES ====================
 WiFiUDP ntpUDP;
-NTPClient* timeClient = nullptr;
+WiFiUDP lanUDP;
 WebServer server(WEB_PORT);
 DNSServer dnsServer;
-CRGB leds[NUM_LEDS];
+CRGB leds[MAX_LEDS];
 
 struct Config {
     char ssid[64] = "";
     char password[128] = "";
     char ntpServer[64] = "pool.ntp.org";
-    int timezoneOffset = 0;
+    char timezone[48] = TZ_DEFAULT;
     int brightness = 64;
     bool configured = false;
-    bool daylightSaving = true;
+    uint8_t transitionStyle = 1;    // TRANSITION_FADE
+    uint16_t transitionMs = TRANSITION_DEFAULT_MS;
+    bool lanTime = false;           // Share one NTP sync between the clocks on the LAN
 };
 
 Config config;
 
+struct Journal {
+    int sectors;
+    int slotSize;
+    const uint8_t* base = nullptr;   // XIP address of slot 0, null when unusable
+    int newestSlot = -1;
+    uint32_t sequence = 0;
+};
+
+Journal configJournal = {JOURNAL_SECTORS, JOURNAL_SLOT_SIZE};
+Journal clockJournal = {CLOCK_JOURNAL_SECTORS, CLOCK_JOURNAL_SLOT_SIZE};
+
 // State variables
 bool configMode = false;
 bool wifiConnected = false;
 unsigned long lastNTPSync = 0;
 unsigned long buttonPressStart = 0;
 bool buttonPressed = false;
-bool rtcInitialized = false;
+volatile bool buttonEdgePending = false;
+volatile unsigned long buttonEdgeAt = 0;
+volatile bool displayUpdatePending = true;
 datetime_t currentTime;
+uint8_t ambientBrightness = BRIGHTNESS;
+uint16_t ambientLightLevel = 0;      // Filtered 12-bit ADC reading
+
+// Non-blocking SNTP exchange, advanced by checkNTPSync() from loop()
+enum NtpState {
+    NTP_IDLE,       // Waiting for the next sync interval
+    NTP_RESOLVING,  // DNS lookup of config.ntpServer in flight
+    NTP_WAITING,    // Request sent, waiting for the reply
+    NTP_BACKOFF     // Last attempt failed, waiting before retrying
+};
+
+struct NtpClientState {
+    NtpState state = NTP_IDLE;
+    unsigned long stateSince = 0;
+    unsigned long retryDelay = NTP_RETRY_MIN;
+    volatile bool dnsDone = false;
+    volatile bool dnsResolved = false;
+    IPAddress serverIP;
+    uint32_t requestCookie = 0;   // Echoed back in the originate timestamp
+    int64_t sentAtUs = 0;         // T1 on the local clock
+    bool synced = false;
+    unsigned long interval = NTP_INTERVAL_MIN;
+    int32_t lastOffsetUs = 0;
+    int32_t lastDelayUs = 0;
+};
+
+NtpClientState ntp;
+
+// LAN time distribution: one clock polls NTP and multicasts beacons, the
+// others follow it. The lowest chip ID among the beaconing clocks wins.
+enum LanTimeRole : uint8_t {
+    LAN_OFF,          // Mode disabled or no link
+    LAN_LISTENING,    // Waiting for a leader
+    LAN_FOLLOWER,     // Following leaderId
+    LAN_LEADER        // Polling NTP and beaconing
+};
+
+static const char* const LAN_ROLE_NAMES[] = {"off", "listening", "follower", "leader"};
+
+// Little endian on the wire, the MAC covers everything before it
+struct __attribute__((packed)) LanBeacon {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t flags;          // LAN_BEACON_*
+    uint16_t intervalMs;    // Leader beacon period
+    uint64_t nodeId;
+    int64_t utcUs;          // Leader clock when the packet was built
+    uint8_t mac[LAN_MAC_BYTES];
+};
+
+#define LAN_BEACON_MAGIC 0x544C4357  // "WCLT"
+#define LAN_BEACON_VERSION 1
+#define LAN_BEACON_SYNCED 0x01       // Leader clock confirmed by NTP
+
+struct LanTimeState {
+    LanTimeRole role = LAN_OFF;
+    uint64_t nodeId = 0;
+    uint64_t leaderId = 0;
+    int64_t leaderUtcUs = 0;       // Newest accepted beacon, older ones are replays
+    unsigned long roleSince = 0;
+    unsigned long lastBeaconAt = 0;
+    unsigned long lastSentAt = 0;
+    unsigned long timeout = LAN_LEADER_TIMEOUT;
+    int64_t bestOffsetUs = 0;      // Least delayed sample of the window
+    int samples = 0;
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    uint32_t rejected = 0;
+    br_hmac_key_context key;
+};
+
+LanTimeState lan;
+
+// Station connection manager, advanced by handleWiFi() from loop()
+enum WiFiLinkState {
+    LINK_IDLE,        // Not trying (no SSID or config mode)
+    LINK_CONNECTING,  // Join in progress
+    LINK_CONNECTED,   // Associated and got an address
+    LINK_BACKOFF      // Join failed or link lost, waiting before retrying
+};
+
+struct WiFiManagerState {
+    WiFiLinkState state = LINK_IDLE;
+    unsigned long stateSince = 0;
+    unsigned long retryDelay = WIFI_RETRY_MIN;
+    bool everConnected = false;
+    uint32_t reconnects = 0;
+};
+
+WiFiManagerState wifiManager;
+
+// Fixed log4 buckets from 16 us to ~4 s plus an overflow bucket; each
+// histogram is only written from one core
+struct Histogram {
+    uint32_t buckets[METRICS_BUCKETS + 1];
+    uint32_t count;
+    uint64_t sumUs;
+};
+
+struct RouteMetric {
+    const char* uri;
+    const char* method;
+    Histogram latency;
+};
+
+struct Metrics {
+    Histogram loopTime;         // Busy part of loop() on core 0
+    Histogram showTime;         // ws2812Show() on core 1
+    Histogram ntpDelay;         // Round trip per accepted sync
+    Histogram ntpOffset;        // |offset| per accepted sync
+    volatile uint32_t framesShown = 0;
+    volatile uint32_t powerLimited = 0;    // Frames dimmed to stay within POWER_BUDGET_MA
+    volatile uint32_t powerEstimateMa = 0; // Last frame sent, idle draw included
+    volatile uint32_t refreshes = 0;   // DMA transfers, dither refreshes included
+    uint32_t ntpSyncs = 0;
+    uint32_t ntpFailures = 0;
+    uint32_t flashWrites = 0;
+    uint32_t flashErases = 0;
+    RouteMetric routes[METRICS_ROUTES_MAX];
+    int routeCount = 0;
+};
+
+Metrics metrics;
+
+// Binary trace events, one ring per core. Each ring has a single producer
+// (its core, with same-core interrupts masked while a slot is claimed)
+// and a single consumer (traceDrain() on core 0), so no lock is shared
+// between the cores.
+enum TraceEventType : uint8_t {
+    TRACE_DROPPED,        // arg1: events lost since the last report
+    TRACE_FRAME_PUBLISHED,
+    TRACE_FRAME_SHOWN,    // arg0: transition style
+    TRACE_NTP_SENT,
+    TRACE_NTP_RECEIVED,   // arg1: offset us (signed)
+    TRACE_NTP_FAILED,
+    TRACE_HTTP_REQUEST,   // arg0: route index, arg1: handler us
+    TRACE_FLASH_COMMIT,   // arg0: sector erased, arg1: us with XIP off
+    TRACE_BUTTON_EDGE,    // arg0: pin level
+    TRACE_WIFI_LINK,      // arg0: 1 up, 0 down
+    TRACE_OTA,            // arg0: 0 start, 1 staged, 2 failed, 3 rollback; arg1: bytes
+    TRACE_LAN_ROLE,       // arg0: LanTimeRole
+    TRACE_LAN_BEACON,     // arg0: 0 sent, 1 applied; arg1: offset us (signed)
+    TRACE_TASK_OVERRUN,   // arg0: task, arg1: run us
+    TRACE_EVENT_COUNT
+};
+
+static const uint8_t TRACE_LEVELS[TRACE_EVENT_COUNT] = {1, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 1};
+
+struct TraceEvent {
+    uint32_t timeUs;
+    uint8_t type;
+    uint8_t core;
+    uint16_t arg0;
+    uint32_t arg1;
+};
+
+struct TraceRing {
+    TraceEvent events[1 << TRACE_RING_BITS];
+    std::atomic<uint32_t> head{0};      // Written by the owning core only
+    std::atomic<uint32_t> tail{0};      // Written by the drain only
+    volatile uint32_t dropped = 0;
+    uint32_t droppedReported = 0;
+};
+
+TraceRing traceRings[2];
+
+// Text log lines from core 0, written out by traceDrain() as the port has
+// room. Whole lines go in or are dropped, so the output never mixes halves.
+struct LogRing {
+    char text[1 << LOG_RING_BITS];
+    uint32_t head = 0;
+    uint32_t tail = 0;
+    uint32_t dropped = 0;
+    uint32_t droppedReported = 0;
+};
+
+LogRing logRing;
+volatile uint8_t traceLevel = TRACE_LEVEL_DEFAULT;
+bool webServerRunning = false;
+
+// Network changes wait until the reply to the request that made them is out
+struct ConfigManager {
+    bool rejoinPending = false;       // New credentials while connected
+    bool leavePortalPending = false;  // Portal saved a network
+    bool restartPending = false;      // Restart once restartAt has passed
+    unsigned long restartAt = 0;
+} configManager;
+
+// Background WiFi scan results for /scan, strongest first, one per SSID
+struct ScanResult {
+    char ssid[33];
+    int32_t rssi;
+};
+
+struct ScanCache {
+    ScanResult results[SCAN_MAX_RESULTS];
+    int count = 0;
+    bool scanning = false;
+    bool valid = false;
+    unsigned long startedAt = 0;
+    unsigned long finishedAt = 0;    // Last attempt, successful or not
+    unsigned long completedAt = 0;   // Last successful scan
+};
+
+ScanCache scanCache;
+
+// Static web files in LittleFS, see WEB ASSETS
+enum WebAssetId {
+    WEB_ASSET_INDEX,
+    WEB_ASSET_CSS,
+    WEB_ASSET_JS,
+    WEB_ASSET_COUNT
+};
+
+struct WebAsset {
+    const char* path;
+    const char* contentType;
+    const char* cacheControl;   // For ?v= requests, others are revalidated
+    bool present;
+    char etag[11];      // "xxxxxxxx" with the quotes
+};
+
+WebAsset webAssets[WEB_ASSET_COUNT] = {
+    {WEB_ASSET_DIR "index.html.gz", "text/html", "no-cache"},
+    {WEB_ASSET_DIR "app.css.gz", "text/css", "public, max-age=31536000, immutable"},
+    {WEB_ASSET_DIR "app.js.gz", "application/javascript", "public, max-age=31536000, immutable"},
+};
+
+// Cooperative tasks run by loop(), see SCHEDULER. The order is the priority.
+enum TaskId {
+    TASK_NETWORK,
+    TASK_TIME_SYNC,
+    TASK_BUTTON,
+    TASK_CONFIG,
+    TASK_DISPLAY,
+    TASK_WIFI,
+    TASK_BRIGHTNESS,
+    TASK_ANIMATION,
+    TASK_SCAN,
+    TASK_SNAPSHOT,
+    TASK_OTA,
+    TASK_TRACE,
+    TASK_COUNT
+};
+
+struct Task {
+    const char* name;
+    uint32_t (*run)();      // Returns us until it is due again, or TASK_PARKED
+    uint8_t modes;          // TASK_PORTAL and/or TASK_STATION
+    bool everyPass;         // Also runs whenever something else woke the loop
+    uint32_t budgetUs;      // Longer runs count as overruns
+    uint64_t dueUs;
+    volatile bool kicked;   // Set from interrupts: due at once
+    uint32_t runs;
+    uint32_t overruns;
+    uint32_t late;
+    uint32_t worstUs;
+};
+
+// ==================== CLOCK FACE LAYOUT ====================
+// Word masks, frame tables and the built-in face live in wordclock_core.h,
+// which the native test build compiles without the Arduino core.
+static_assert(MAX_LEDS <= 64, "FrameMask holds one bit per LED");
+static_assert(NUM_LEDS == BUILTIN_FACE_LEDS, "built-in face size");
+
+// Layout file, little endian, packed:
+//   LayoutHeader
+//   LayoutSpan words[wordCount]   word -> LEDs first .. first + count - 1
+//   uint32_t hours[12]            word set per hour (bit w = words[w])
+//   uint32_t minutes[60]          word set per minute
+//   uint32_t crc                  CRC32 of everything before it
+// Special words (HET IS, AM, PM) are indices into words[], or LAYOUT_NONE.
+#define LAYOUT_FILE "/layout.bin"
+#define LAYOUT_MAGIC 0x594C4B57      // "WKLY"
+#define LAYOUT_VERSION 1
+#define LAYOUT_MAX_WORDS 32
+#define LAYOUT_NONE 0xFF
+
+struct __attribute__((packed)) LayoutHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t numLeds;
+    uint8_t wordCount;
+    uint8_t hourAdvance;
+    uint8_t alwaysOnWord;
+    uint8_t amWord;
+    uint8_t pmWord;
+    uint8_t reserved;
+    char name[16];
+};
+
+struct __attribute__((packed)) LayoutSpan {
+    uint8_t first;
+    uint8_t count;
+};
+
+ClockFace loadedFace;
+// Set once in setup() before the first frame is published; core 1 only
+// reads it while rendering
+const ClockFace* volatile clockFace = &BUILTIN_FACE;
+
+// Everything that determines what the strip shows; two equal frames
+// produce identical output, so the second one never needs a show().
+enum TransitionStyle : uint8_t {
+    TRANSITION_NONE,
+    TRANSITION_FADE,        // Crossfade every LED
+    TRANSITION_WIPE,        // New frame sweeps in along the strip
+    TRANSITION_TYPEWRITER,  // Old words go out, then new ones come on, LED by LED
+    TRANSITION_STYLE_COUNT
+};
+
+static const char* const TRANSITION_NAMES[TRANSITION_STYLE_COUNT] = {"None", "Fade", "Wipe", "Typewriter"};
+
+struct Frame {
+    FrameMask mask;
+    CRGB color;          // Lit words
+    CRGB alwaysOnColor;  // HET IS
+    uint8_t brightness;
+    uint8_t transition;       // How to get here from the previous frame,
+    uint16_t transitionMs;    // not part of what is shown
+    uint64_t showAtUs;        // Scheduled frames: timer value to start at, 0 cancels
+    
+    bool operator==(const Frame& other) const {
+        return mask == other.mask && color == other.color &&
+               alwaysOnColor == other.alwaysOnColor && brightness == other.brightness;
+    }
+    bool operator!=(const Frame& other) const { return !(*this == other); }
+};
+
+// Last frame sent to the strip (core 1 only)
+Frame lastPushedFrame = {0, CRGB::Black, CRGB::Black, 0, TRANSITION_NONE, 0, 0};
+bool lastPushedFrameValid = false;
+uint32_t framesPushed = 0;
+uint32_t framesSkipped = 0;
+
+// ==================== FRAME MAILBOX ====================
+// Core 0 publishes frames, core 1 owns leds[] and the WS2812 driver and
+// pushes them out. Single producer, single consumer seqlock: the writer never waits,
+// the reader retries if a publish raced its copy. Only plain loads and
+// stores are used, which are atomic on the Cortex-M0+ without libatomic.
+// The SIO FIFO is left alone because the core uses it to pause core 1
+// during flash writes; a publish wakes core 1 with SEV instead.
+struct FrameMailbox {
+    std::atomic<uint32_t> sequence{0};
+    Frame frame = {0, CRGB::Black, CRGB::Black, 0, TRANSITION_NONE, 0, 0};
+    
+    void publish(const Frame& next) {
+        uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        frame = next;
+        std::atomic_thread_fence(std::memory_order_release);
+        sequence.store(seq + 2, std::memory_order_relaxed);
+        __sev();
+    }
+    
+    // Copies the newest frame if it differs from lastSequence
+    bool take(Frame& out, uint32_t& lastSequence) {
+        while (true) {
+            uint32_t before = sequence.load(std::memory_order_acquire);
+            if (before == lastSequence) return false;
+            if (before & 1) continue;
+            out = frame;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == before) {
+                lastSequence = before;
+                return true;
+            }
+        }
+    }
+};
 
-// ==================== LED MAPPING FOR DUTCH WORDS ====================
-const int UUR_LEDS[] = {2, 3, 4};
-const int HETIS_LEDS[] = {51, 52, 53, 54, 55};
-const int AM_LED = 1;
-const int PM_LED = 0;
-
-const int HOUR_LEDS[][3] = {
-    {5, -1, -1},      // 12/0 (TWAALF)
-    {16, -1, -1},     // 1 (EEN)
-    {15, -1, -1},     // 2 (TWEE) 
-    {14, -1, -1},     // 3 (DRIE)
-    {6, -1, -1},      // 4 (VIER)
-    {7, -1, -1},      // 5 (VIJF)
-    {8, -1, -1},      // 6 (ZES)
-    {9, -1, -1},      // 7 (ZEVEN)
-    {10, -1, -1},     // 8 (ACHT)
-    {11, -1, -1},     // 9 (NEGEN)
-    {12, -1, -1},     // 10 (TIEN)
-    {13, -1, -1}      // 11 (ELF)
-};
-
-const int PRECIES_LEDS[] = {36, 37, 38, 39, 40, 41, 42};
-const int RUIM_LEDS[] = {47, 48, 49, 50};
-const int BIJNA_LEDS[] = {43, 44, 45, 46};
-const int VIJF_MIN_LED = 35;
-const int TIEN_MIN_LED = 34;
-const int KWART_LEDS[] = {29, 30, 31, 32, 33};
-const int VOOR_LEDS[] = {21, 22, 23, 24};
-const int OVER_LEDS[] = {25, 26, 27, 28};
-const int HALF_LEDS[] = {17, 18, 19, 20};
+FrameMailbox frameMailbox;
+FrameMailbox scheduleMailbox;   // Next minute's frame, started by core 1 on time
+uint64_t nextFlipUs = 0;        // showAtUs of the scheduled frame, core 0 copy
 
 // ==================== FUNCTION DECLARATIONS ====================
-void lightUpWord(const int* leds_array, int count);
+void ambientLightInit();
 void updateBrightness();
+void ws2812Init();
+void ws2812Show(const CRGB* pixels, uint8_t brightness);
+uint32_t colorLoad(const CRGB& color);
+uint32_t frameLoad(const Frame& frame);
+uint32_t pixelsLoad(const CRGB* pixels, int count);
+uint8_t powerLimit(uint32_t loadUa, uint8_t brightness);
+void ws2812Service();
+bool ws2812Busy();
+uint32_t usUntil(uint32_t deadline, uint32_t now);
+void ws2812Encode();
 void startupAnimation();
 void configModeAnimation();
-uint32_t calculateChecksum(const ConfigData* data);
+uint32_t calculateChecksum(const void* data, size_t length);
+uint32_t crc32Update(uint32_t crc, const void* data, size_t length);
+bool crcStart(uint32_t crc, const void* data, size_t length);
+bool crcBusy();
+uint32_t crcResult();
+void journalsBegin();
+bool journalAppend(Journal& journal, uint16_t version, const void* payload, uint16_t length);
+void journalErase(Journal& journal);
+void clockRestore();
+void clockSnapshotSave();
+void clockScratchSave();
+void checkClockSnapshot();
+void migrateTimezone(int offset, bool daylightSaving, char* rule, size_t size);
 void setupEEPROM();
+bool loadLayout(const char* path, ClockFace& face);
+void layoutBegin();
 void loadConfiguration();
 void saveConfiguration();
+uint8_t applyConfig(const Config& next);
+void applyPendingConfig();
+void requestRestart();
 void resetConfiguration();
 bool connectToWiFi();
+bool wifiLinkUp();
+void handleWiFi();
 void initializeNTPClient();
 void cleanupWiFi();
+void startWiFiScan();
+void collectWiFiScan();
+void handleWiFiScan();
 void syncTimeWithNTP();
-void updateRTCFromNTP();
-void initializeRTC();
+void sendNTPRequest();
+bool readNTPResponse(int64_t& utcUs);
+void retryNTPLater();
+int64_t clockNowUs();
+uint32_t clockNow();
+void clockSet(int64_t utcUs);
+void clockLocalTime(datetime_t& out, int64_t aheadUs = 0);
+int64_t applyNTPTime(int64_t utcUs);
+void adaptNTPInterval(int64_t errorUs, bool firstSync);
+bool ntpActive();
+void lanTimeBegin();
+void lanTimeStop();
+void lanTimeService();
+void lanTimeSetRole(LanTimeRole role);
+void armMinuteAlarm(int64_t afterUs = 0);
+void requestDisplayUpdate();
 void checkNTPSync();
-void getCurrentTime();
-bool isDaylightSavingActive();
+void getCurrentTime(int64_t aheadUs = 0);
+int64_t displayLeadUs();
+bool tzBegin(const char* spec);
+int32_t tzOffsetAt(int64_t utc);
+FrameMask buildTimeFrame(int hour, int minute);
+void renderFrame(const Frame& frame);
+void showFrame(const Frame& frame);
+CRGB framePixel(const Frame& frame, int index);
+void startTransition(const Frame& from, const Frame& to);
+void stepTransition();
+void publishFrame(const Frame& frame);
+void invalidateFrame();
 void displayTime();
-void displayAlwaysOn();
-void displayAMPM();
-int getDisplayHour();
-void displayHour_func(int hour);
-void displayMinutes();
-String generateCompactHTML(const String& title, const String& body, const String& script = "");
+Frame timeFrame(const datetime_t& time);
+void scheduleFrame(const Frame& frame);
+class ChunkedResponse;
+void sendPageHeader(ChunkedResponse& out, const __FlashStringHelper* title);
+void sendPageFooter(ChunkedResponse& out, const __FlashStringHelper* script = nullptr);
 void setupWebServer();
+void setupApiRoutes();
+void webAssetsBegin();
+bool serveWebAsset(int asset);
+bool clientAcceptsGzip();
+void sendSetupPage();
+void setupMetricsRoutes();
+void webServerBegin();
+void mdnsBegin();
+void onRoute(const char* uri, HTTPMethod method, WebServer::THandlerFunction handler,
+             WebServer::THandlerFunction upload = nullptr);
+void setupOtaRoutes();
+void otaBootCheck();
+void otaConfirm();
+void metricsObserve(Histogram& histogram, uint32_t us);
+size_t largestFreeBlock();
+void trace(uint8_t type, uint16_t arg0 = 0, uint32_t arg1 = 0);
+void logPrintf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+bool traceDrain();
+void configButtonISR();
 void handleConfigButton();
 void enterConfigMode();
+void leaveConfigMode();
+bool webAuthorized();
+int ambientTarget();
+void taskKick(TaskId id);
+void schedulerRun();
+void schedulerSleep();
+void printTaskMetrics(Print& out);
 
-// ==================== UTILITY FUNCTIONS ====================
-void lightUpWord(const int* leds_array, int count) {
-    for (int i = 0; i < count; i++) {
-        leds[leds_array[i]] = CRGB::White;
-    }
+// ==================== AMBIENT LIGHT ====================
+// The ADC free-runs at AMBIENT_SAMPLE_RATE and DMA writes the samples into
+// a ring buffer, so sampling takes no CPU time. updateBrightness() only
+// averages the ring, rejects spikes with a median of three, smooths with a
+// fixed-point IIR and applies hysteresis before touching the brightness.
+#define AMBIENT_RING_SAMPLES ((1 << AMBIENT_RING_BITS) / sizeof(uint16_t))
+
+uint16_t ambientSamples[AMBIENT_RING_SAMPLES] __attribute__((aligned(1 << AMBIENT_RING_BITS)));
+int ambientDmaChannel = -1;
+
+void ambientLightInit() {
+    adc_init();
+    adc_gpio_init(BRIGHTNESS_PIN);
+    adc_select_input(BRIGHTNESS_ADC_INPUT);
+    adc_fifo_setup(true, true, 1, false, false);
+    adc_set_clkdiv(48000000.0f / AMBIENT_SAMPLE_RATE - 1);
+    
+    ambientDmaChannel = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(ambientDmaChannel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, AMBIENT_RING_BITS);
+    channel_config_set_dreq(&c, DREQ_ADC);
+    dma_channel_configure(ambientDmaChannel, &c, ambientSamples, &adc_hw->fifo, 0xFFFFFFFF, true);
+    
+    adc_run(true);
 }
 
-void updateBrightness() {
-    static unsigned long lastBrightnessCheck = 0;
-    if (millis() - lastBrightnessCheck > 1000) {
-        int brightnessReading = analogRead(BRIGHTNESS_PIN);
-        int brightness = map(brightnessReading, 0, 4095, 10, 255);
-        FastLED.setBrightness(brightness);
-        lastBrightnessCheck = millis();
-    }
+// The ambient level scales between the floor and the configured maximum
+int ambientTarget() {
+    return map(ambientLightLevel, 0, 4095, 10, max(config.brightness, 10));
 }
 
-// ==================== ANIMATION FUNCTIONS ====================
-void startupAnimation() {
-    for (int i = 0; i < NUM_LEDS; i += 2) {
-        leds[i] = CHSV(i * 255 / NUM_LEDS, 255, 255);
-        if (i + 1 < NUM_LEDS) leds[i + 1] = CHSV((i + 1) * 255 / NUM_LEDS, 255, 255);
-        FastLED.show();
-        delay(25);
+void updateBrightness() {
+    static uint16_t history[3] = {0, 0, 0};
+    static uint32_t filteredQ8 = 0;
+    static bool primed = false;
+    
+    // A full transfer count lasts ~49 days at 1 kHz; re-arm when it runs out
+    if (!dma_channel_is_busy(ambientDmaChannel)) {
+        dma_channel_set_trans_count(ambientDmaChannel, 0xFFFFFFFF, true);
     }
     
-    for (int brightness = 255; brightness >= 0; brightness -= 10) {
-        FastLED.setBrightness(brightness);
-        FastLED.show();
-        delay(10);
+    uint32_t sum = 0;
+    for (size_t i = 0; i < AMBIENT_RING_SAMPLES; i++) {
+        sum += ambientSamples[i] & 0x0FFF;
     }
+    uint16_t mean = sum / AMBIENT_RING_SAMPLES;
     
-    FastLED.clear();
-    FastLED.setBrightness(config.brightness);
-    FastLED.show();
+    if (!primed) {
+        history[0] = history[1] = history[2] = mean;
+        filteredQ8 = (uint32_t)mean << 8;
+        primed = true;
+    }
+    history[0] = history[1];
+    history[1] = history[2];
+    history[2] = mean;
+    
+    uint16_t a = history[0], b = history[1], c = history[2];
+    uint16_t median = max(min(a, b), min(max(a, b), c));
+    
+    filteredQ8 += (((int32_t)median << 8) - (int32_t)filteredQ8) >> AMBIENT_IIR_SHIFT;
+    ambientLightLevel = filteredQ8 >> 8;
+    
+    int target = ambientTarget();
+    if (abs(target - (int)ambientBrightness) >= BRIGHTNESS_HYSTERESIS ||
+        (target != ambientBrightness && (target == 10 || target == config.brightness))) {
+        ambientBrightness = target;
+        requestDisplayUpdate();
+    }
 }
 
-void configModeAnimation() {
-    static unsigned long lastUpdate = 0;
-    static int brightness = 0;
-    static int direction = 1;
+// ==================== WS2812 OUTPUT DRIVER ====================
+// PIO state machine fed by DMA: ws2812Show() encodes into the back buffer
+// and returns immediately, the transfer runs without the CPU. Core 1 only.
+// Program from pico-examples ws2812.pio (T1=2, T2=5, T3=3, side-set 1).
+static const uint16_t ws2812ProgramInstructions[] = {
+    0x6221,  // 0: out    x, 1    side 0 [2]
+    0x1123,  // 1: jmp    !x, 3   side 1 [1]
+    0x1400,  // 2: jmp    0       side 1 [4]
+    0xa442,  // 3: nop            side 0 [4]
+};
+
+static const pio_program_t ws2812Program = {
+    ws2812ProgramInstructions,
+    4,
+    -1
+};
+
+#define WS2812_CYCLES_PER_BIT 10
+
+PIO ws2812Pio = pio0;  // pio1 is used by the CYW43 SPI bus
+int ws2812Sm = -1;
+int ws2812DmaChannel = -1;
+uint32_t ws2812Buffers[2][MAX_LEDS];
+int ws2812Front = 0;
+bool ws2812Pending = false;
+volatile bool ws2812DmaActive = false;
+volatile uint32_t ws2812DoneAt = 0;
+volatile uint32_t ws2812FramesSent = 0;
+
+// Colour pipeline: 8-bit colour -> gamma and LED_CORRECTION (one LUT per
+// channel, 8.8 fixed point) -> brightness -> sigma-delta dither to 8 bits.
+// The LUTs are filled once at init; per pixel it is all integer maths.
+uint16_t ws2812Lut[3][256];
+uint16_t ws2812LoadUa[3][256];        // Current per channel level at brightness 255
+uint16_t ws2812Levels[MAX_LEDS][3];   // Target level per channel, 8.8
+uint8_t ws2812DitherAcc[MAX_LEDS][3];
+bool ws2812Dithering = false;         // Some level has a fractional part
+uint32_t ws2812EncodedAt = 0;
+uint8_t ws2812Count = NUM_LEDS;       // LEDs in the back buffer
+
+void ws2812BuildLuts() {
+    CRGB correction = LED_CORRECTION;
+    for (int c = 0; c < 3; c++) {
+        for (int v = 0; v < 256; v++) {
+            float level = powf(v / 255.0f, WS2812_GAMMA) * correction[c] * 256.0f;
+            ws2812Lut[c][v] = (uint16_t)(level + 0.5f);
+            // The PWM duty is the level, so the current follows it linearly
+            ws2812LoadUa[c][v] = (uint32_t)ws2812Lut[c][v] * (WS2812_CHANNEL_MA * 1000) / 0xFF00;
+        }
+    }
     
-    if (millis() - lastUpdate > 100) {
-        brightness += direction * 20;
-        if (brightness >= 255) {
-            brightness = 255;
-            direction = -1;
-        } else if (brightness <= 0) {
-            brightness = 0;
-            direction = 1;
+    // Spread the accumulator phases so LEDs don't all step on the same refresh
+    for (int i = 0; i < MAX_LEDS; i++) {
+        for (int c = 0; c < 3; c++) {
+            ws2812DitherAcc[i][c] = (i * 97 + c * 53) & 0xFF;
         }
-        
-        fill_solid(leds, NUM_LEDS, CHSV(160, 255, brightness));
-        FastLED.show();
-        lastUpdate = millis();
     }
 }
 
-// ==================== TIME FUNCTIONS ====================
-bool isDaylightSavingActive() {
-    if (!config.daylightSaving) return false;
+void ws2812DmaHandler() {
+    if (!dma_channel_get_irq1_status(ws2812DmaChannel)) return;
+    dma_channel_acknowledge_irq1(ws2812DmaChannel);
+    ws2812DoneAt = time_us_32();
+    ws2812DmaActive = false;
+    ws2812FramesSent++;
+    __sev();  // Wakes loop1() for the latch deadline
+}
+
+void ws2812Init() {
+    ws2812BuildLuts();
     
-    int month = currentTime.month;
-    int day = currentTime.day;
+    uint offset = pio_add_program(ws2812Pio, &ws2812Program);
+    ws2812Sm = pio_claim_unused_sm(ws2812Pio, true);
     
-    if (month < 3 || month > 10) return false;
-    if (month > 3 && month < 10) return true;
+    pio_gpio_init(ws2812Pio, LED_PIN);
+    pio_sm_set_consistent_pindirs(ws2812Pio, ws2812Sm, LED_PIN, 1, true);
     
-    if (month == 3) return day >= 25;
-    if (month == 10) return day < 25;
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset, offset + 3);
+    sm_config_set_sideset(&c, 1, false, false);
+    sm_config_set_sideset_pins(&c, LED_PIN);
+    sm_config_set_out_shift(&c, false, true, 24);
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_TX);
+    sm_config_set_clkdiv(&c, (float)clock_get_hz(clk_sys) / (WS2812_FREQ * WS2812_CYCLES_PER_BIT));
+    pio_sm_init(ws2812Pio, ws2812Sm, offset, &c);
+    pio_sm_set_enabled(ws2812Pio, ws2812Sm, true);
     
-    return false;
+    ws2812DmaChannel = dma_claim_unused_channel(true);
+    dma_channel_config dc = dma_channel_get_default_config(ws2812DmaChannel);
+    channel_config_set_transfer_data_size(&dc, DMA_SIZE_32);
+    channel_config_set_read_increment(&dc, true);
+    channel_config_set_write_increment(&dc, false);
+    channel_config_set_dreq(&dc, pio_get_dreq(ws2812Pio, ws2812Sm, true));
+    dma_channel_configure(ws2812DmaChannel, &dc, &ws2812Pio->txf[ws2812Sm], nullptr, ws2812Count, false);
+    
+    // Registered from core 1, so the completion interrupt runs there too
+    irq_add_shared_handler(DMA_IRQ_1, ws2812DmaHandler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    dma_channel_set_irq1_enabled(ws2812DmaChannel, true);
+    irq_set_enabled(DMA_IRQ_1, true);
+}
+
+bool ws2812Busy() {
+    return ws2812DmaActive || ws2812Pending || (time_us_32() - ws2812DoneAt) < WS2812_LATCH_US;
 }
 
-void updateRTCFromNTP() {
-    if (timeClient == nullptr) return;
+void ws2812Show(const CRGB* pixels, uint8_t brightness) {
+    uint32_t startedAt = time_us_32();
+    uint32_t scale = brightness * 257 + 1;  // 1..65536, so 255 passes levels through unchanged
+    uint16_t fraction = 0;
     
-    unsigned long epochTime = timeClient->getEpochTime();
-    time_t rawTime = epochTime;
-    struct tm *timeInfo = gmtime(&rawTime);
+    ws2812Count = clockFace->numLeds;
+    for (int i = 0; i < ws2812Count; i++) {
+        for (int c = 0; c < 3; c++) {
+            uint16_t level = ((uint32_t)ws2812Lut[c][pixels[i][c]] * scale) >> 16;
+            ws2812Levels[i][c] = level;
+            
+            // Below one step dithering would flicker visibly, so round those instead
+            if (level < 0x100) continue;
+            fraction |= level & 0xFF;
+        }
+    }
+    ws2812Dithering = fraction != 0;
     
-    currentTime.year = timeInfo->tm_year + 1900;
-    currentTime.month = timeInfo->tm_mon + 1;
-    currentTime.day = timeInfo->tm_mday;
-    currentTime.hour = timeInfo->tm_hour;
-    currentTime.min = timeInfo->tm_min;
-    currentTime.sec = timeInfo->tm_sec;
-    currentTime.dotw = timeInfo->tm_wday;
+    ws2812Encode();
+    ws2812Service();
     
-    if (isDaylightSavingActive()) {
-        currentTime.hour += 1;
-        if (currentTime.hour >= 24) {
-            currentTime.hour = 0;
+    metrics.framesShown++;
+    metricsObserve(metrics.showTime, time_us_32() - startedAt);
+}
+
+// Quantises the levels into the back buffer, carrying each channel's
+// fractional part over to the next refresh
+void ws2812Encode() {
+    // The front buffer may still be on the wire; only ever touch the back one
+    uint32_t* buffer = ws2812Buffers[ws2812Front ^ 1];
+    for (int i = 0; i < ws2812Count; i++) {
+        uint8_t out[3];
+        for (int c = 0; c < 3; c++) {
+            uint16_t level = ws2812Levels[i][c];
+            if (level < 0x100) {
+                out[c] = (level + 0x80) >> 8;
+                continue;
+            }
+            uint16_t sum = ws2812DitherAcc[i][c] + (level & 0xFF);
+            ws2812DitherAcc[i][c] = sum & 0xFF;
+            out[c] = min((level >> 8) + (sum >> 8), 255);
         }
+        buffer[i] = ((uint32_t)out[1] << 24) | ((uint32_t)out[0] << 16) | ((uint32_t)out[2] << 8);
     }
-    
-    rtc_set_datetime(&currentTime);
-    rtcInitialized = true;
+    ws2812EncodedAt = time_us_32();
+    ws2812Pending = true;
 }
 
-void syncTimeWithNTP() {
-    if (!wifiConnected || timeClient == nullptr) return;
-    
-    int attempts = 0;
-    while (!timeClient->update() && attempts < 5) {
-        timeClient->forceUpdate();
-        delay(500);
-        attempts++;
+// Starts a pending frame once the previous one has latched, and keeps
+// refreshing at WS2812_DITHER_HZ while the dither has something to do
+void ws2812Service() {
+    if (!ws2812Pending && ws2812Dithering && time_us_32() - ws2812EncodedAt >= WS2812_DITHER_US) {
+        ws2812Encode();
     }
+    if (!ws2812Pending || ws2812DmaActive || (time_us_32() - ws2812DoneAt) < WS2812_LATCH_US) return;
     
-    if (attempts < 5) {
-        lastNTPSync = millis();
-        updateRTCFromNTP();
-    }
+    ws2812Front ^= 1;
+    ws2812Pending = false;
+    ws2812DmaActive = true;
+    metrics.refreshes++;
+    dma_channel_set_trans_count(ws2812DmaChannel, ws2812Count, false);
+    dma_channel_set_read_addr(ws2812DmaChannel, ws2812Buffers[ws2812Front], true);
 }
 
-void initializeRTC() {
-    rtc_init();
+// ==================== POWER LIMITER ====================
+// Estimates each frame's current before it is sent and dims it just enough
+// to stay within POWER_BUDGET_MA. For a frame this is two popcounts and
+// three LUT reads per colour (frameLoadUa() in wordclock_core.h); only
+// the free-form startup animation sums its pixels. Core 1 only.
+uint32_t colorLoad(const CRGB& color) {
+    return ws2812LoadUa[0][color.r] + ws2812LoadUa[1][color.g] + ws2812LoadUa[2][color.b];
 }
 
-void checkNTPSync() {
-    if (millis() - lastNTPSync > NTP_SYNC_INTERVAL) {
-        syncTimeWithNTP();
-    }
+uint32_t frameLoad(const Frame& frame) {
+    return frameLoadUa(frame.mask & clockFace->all, clockFace->alwaysOn, colorLoad(frame.color), colorLoad(frame.alwaysOnColor));
 }
 
-void getCurrentTime() {
-    if (rtcInitialized && rtc_get_datetime(&currentTime)) {
-        return;
-    } else if (timeClient != nullptr) {
-        unsigned long epochTime = timeClient->getEpochTime();
-        epochTime += config.timezoneOffset;
-        
-        if (config.daylightSaving && isDaylightSavingActive()) {
-            epochTime += 3600;
-        }
-        
-        time_t rawTime = epochTime;
-        struct tm *timeInfo = gmtime(&rawTime);
-        
-        currentTime.hour = timeInfo->tm_hour;
-        currentTime.min = timeInfo->tm_min;
-        currentTime.sec = timeInfo->tm_sec;
-        currentTime.year = timeInfo->tm_year + 1900;
-        currentTime.month = timeInfo->tm_mon + 1;
-        currentTime.day = timeInfo->tm_mday;
-        currentTime.dotw = timeInfo->tm_wday;
-    }
+uint32_t pixelsLoad(const CRGB* pixels, int count) {
+    uint32_t load = 0;
+    for (int i = 0; i < count; i++) load += colorLoad(pixels[i]);
+    return load;
 }
 
-// ==================== EEPROM FUNCTIONS ====================
-uint32_t calculateChecksum(const ConfigData* data) {
-    uint32_t checksum = 0;
-    const uint8_t* bytes = (const uint8_t*)data;
-    for (size_t i = 0; i < sizeof(ConfigData) - sizeof(uint32_t); i++) {
-        checksum += bytes[i];
-    }
-    return checksum;
+uint8_t powerLimit(uint32_t loadUa, uint8_t brightness) {
+    uint32_t idleUa = clockFace->numLeds * WS2812_IDLE_UA;
+    uint32_t budgetUa = POWER_BUDGET_MA * 1000 > idleUa ? POWER_BUDGET_MA * 1000 - idleUa : 0;
+    uint8_t limited = powerLimitBrightness(brightness, loadUa, budgetUa);
+    if (limited < brightness) metrics.powerLimited++;
+    metrics.powerEstimateMa = (scaledLoadUa(loadUa, limited) + idleUa) / 1000;
+    return limited;
 }
 
-void setupEEPROM() {
-    EEPROM.begin(EEPROM_SIZE);
-}
+// ==================== TRANSITIONS ====================
+// Blends the previous frame into the next on core 1 at TRANSITION_FPS.
+// Progress follows elapsed time, so a late frame never slows the anim
+// down; frames that start late or overrun TRANSITION_BUDGET_US are counted.
+struct TransitionState {
+    bool active = false;
+    Frame from;
+    Frame to;
+    uint32_t startUs = 0;
+    uint32_t durationUs = 0;
+    uint32_t nextFrameUs = 0;
+    uint32_t loadUa = 0;        // Bound for every in-between frame
+};
 
-void loadConfiguration() {
-    Serial.println("Loading configuration from EEPROM...");
+TransitionState transition;
+volatile uint32_t transitionFrames = 0;
+volatile uint32_t transitionMissedDeadlines = 0;
+
+void startTransition(const Frame& from, const Frame& to) {
+    transition.from = from;
+    transition.to = to;
+    transition.startUs = time_us_32();
+    transition.durationUs = (uint32_t)min(to.transitionMs, (uint16_t)TRANSITION_MAX_MS) * 1000;
+    transition.nextFrameUs = transition.startUs;
     
-    ConfigData tempConfig;
-    EEPROM.get(CONFIG_ADDRESS, tempConfig);
+    // In-between frames only light LEDs of either frame, in either colour;
+    // a fade stays below this as well, the gamma curve being convex
+    FrameMask all = (from.mask | to.mask) & clockFace->all;
+    transition.loadUa = frameLoadUa(all, clockFace->alwaysOn, max(colorLoad(from.color), colorLoad(to.color)),
+                                    max(colorLoad(from.alwaysOnColor), colorLoad(to.alwaysOnColor)));
+    transition.active = true;
+    stepTransition();
+}
+
+void renderTransition(uint8_t progress) {
+    const Frame& from = transition.from;
+    const Frame& to = transition.to;
+    int count = clockFace->numLeds;
     
-    uint32_t calculatedChecksum = calculateChecksum(&tempConfig);
-    if (tempConfig.checksum != calculatedChecksum) {
-        Serial.println("Invalid configuration checksum, using defaults");
-        config.configured = false;
-        return;
+    switch (to.transition) {
+        case TRANSITION_WIPE: {
+            int edge = ((uint16_t)progress * count) >> 8;
+            for (int i = 0; i < count; i++) {
+                leds[i] = framePixel(i < edge ? to : from, i);
+            }
+            break;
+        }
+        
+        case TRANSITION_TYPEWRITER: {
+            // First half: leaving LEDs go out in order; second half: new ones come on
+            FrameMask leaving = from.mask & ~to.mask;
+            FrameMask arriving = to.mask & ~from.mask;
+            int goneCount = progress < 128 ? (__builtin_popcountll(leaving) * progress) >> 7 : count;
+            int litCount = progress < 128 ? 0 : (__builtin_popcountll(arriving) * (progress - 128)) >> 7;
+            
+            for (int i = 0; i < count; i++) {
+                FrameMask bit = FrameMask(1) << i;
+                if (leaving & bit) {
+                    leds[i] = (goneCount-- > 0) ? CRGB(CRGB::Black) : framePixel(from, i);
+                } else if (arriving & bit) {
+                    leds[i] = (litCount-- > 0) ? framePixel(to, i) : CRGB(CRGB::Black);
+                } else {
+                    leds[i] = framePixel(to, i);
+                }
+            }
+            break;
+        }
+        
+        case TRANSITION_FADE:
+        default:
+            for (int i = 0; i < count; i++) {
+                leds[i] = blend(framePixel(from, i), framePixel(to, i), progress);
+            }
+            break;
     }
-    
-    strlcpy(config.ssid, tempConfig.ssid, sizeof(config.ssid));
-    strlcpy(config.password, tempConfig.password, sizeof(config.password));
-    strlcpy(config.ntpServer, tempConfig.ntpServer, sizeof(config.ntpServer));
-    config.timezoneOffset = tempConfig.timezoneOffset;
-    config.brightness = tempConfig.brightness;
-    config.configured = tempConfig.configured;
-    config.daylightSaving = tempConfig.daylightSaving;
-    
-    Serial.println("Configuration loaded successfully");
 }
 
-void saveConfiguration() {
-    Serial.println("Saving configuration to EEPROM...");
+// Core 1: called every loop1() pass, renders when the next frame is due
+void stepTransition() {
+    if (!transition.active) return;
     
-    ConfigData tempConfig = {0};
+    uint32_t now = time_us_32();
+    if ((int32_t)(now - transition.nextFrameUs) < 0) return;
+    if (now - transition.nextFrameUs > TRANSITION_FRAME_US) transitionMissedDeadlines++;
     
-    strlcpy(tempConfig.ssid, config.ssid, sizeof(tempConfig.ssid));
-    strlcpy(tempConfig.password, config.password, sizeof(tempConfig.password));
-    strlcpy(tempConfig.ntpServer, config.ntpServer, sizeof(tempConfig.ntpServer));
-    tempConfig.timezoneOffset = config.timezoneOffset;
-    tempConfig.brightness = config.brightness;
-    tempConfig.configured = true;
-    tempConfig.daylightSaving = config.daylightSaving;
-    tempConfig.checksum = calculateChecksum(&tempConfig);
+    uint32_t elapsed = now - transition.startUs;
+    if (elapsed >= transition.durationUs) {
+        transition.active = false;
+        renderFrame(transition.to);
+        ws2812Show(leds, powerLimit(frameLoad(transition.to), transition.to.brightness));
+        return;
+    }
     
-    EEPROM.put(CONFIG_ADDRESS, tempConfig);
-    EEPROM.commit();
+    uint8_t progress = ((uint64_t)elapsed << 8) / transition.durationUs;
+    renderTransition(progress);
+    uint8_t brightness = lerp8by8(transition.from.brightness, transition.to.brightness, progress);
+    ws2812Show(leds, powerLimit(transition.loadUa, brightness));
+    transitionFrames++;
     
-    config.configured = true;
-    Serial.println("Configuration saved to EEPROM successfully");
+    uint32_t cost = time_us_32() - now;
+    transition.nextFrameUs += TRANSITION_FRAME_US;
+    if (cost > TRANSITION_BUDGET_US) {
+        transitionMissedDeadlines++;
+        transition.nextFrameUs += TRANSITION_FRAME_US;  // Drop a frame to get back in budget
+    }
+    if ((int32_t)(now - transition.nextFrameUs) > 0) {
+        transition.nextFrameUs = now + TRANSITION_FRAME_US;
+    }
 }
 
-void resetConfiguration() {
-    Serial.println("Resetting EEPROM configuration...");
-    
-    ConfigData emptyConfig = {0};
-    emptyConfig.configured = false;
-    emptyConfig.checksum = calculateChecksum(&emptyConfig);
-    
-    EEPROM.put(CONFIG_ADDRESS, emptyConfig);
-    EEPROM.commit();
-    
-    memset(&config, 0, sizeof(config));
-    config.timezoneOffset = 0;
-    config.brightness = 64;
-    strcpy(config.ntpServer, "pool.ntp.org");
-    config.configured = false;
-    config.daylightSaving = true;
-    
-    Serial.println("Configuration reset complete");
+// ==================== ANIMATION FUNCTIONS ====================
+// Stops as soon as core 0 publishes a real frame
+bool startupInterrupted() {
+    return frameMailbox.sequence.load(std::memory_order_relaxed) != 0;
 }
 
-// ==================== WIFI FUNCTIONS ====================
-bool connectToWiFi() {
-    if (strlen(config.ssid) == 0) {
-        return false;
+void startupAnimation() {
+    int count = clockFace->numLeds;
+    for (int i = 0; i < count && !startupInterrupted(); i += 2) {
+        leds[i] = CHSV(i * 255 / count, 255, 255);
+        if (i + 1 < count) leds[i + 1] = CHSV((i + 1) * 255 / count, 255, 255);
+        ws2812Show(leds, powerLimit(pixelsLoad(leds, count), 255));
+        delay(25);
     }
     
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(config.ssid, config.password);
-    
-    unsigned long startTime = millis();
-    while (WiFi.status() != WL_CONNECTED && millis() - startTime < WIFI_TIMEOUT) {
-        delay(250);
+    uint32_t load = pixelsLoad(leds, count);
+    for (int brightness = 255; brightness >= 0 && !startupInterrupted(); brightness -= 10) {
+        ws2812Show(leds, powerLimit(load, brightness));
+        delay(10);
     }
     
-    if (WiFi.status() == WL_CONNECTED) {
-        wifiConnected = true;
-        return true;
-    } else {
-        wifiConnected = false;
-        return false;
-    }
+    fill_solid(leds, MAX_LEDS, CRGB::Black);
+    ws2812Show(leds, 0);
+    invalidateFrame();
 }
 
-void initializeNTPClient() {
-    if (timeClient != nullptr) {
-        timeClient->end();
-        delete timeClient;
+// One step of the pulse, every ANIMATION_STEP_US from the scheduler
+void configModeAnimation() {
+    static int brightness = 0;
+    static int direction = 1;
+    
+    brightness += direction * 20;
+    if (brightness >= 255) {
+        brightness = 255;
+        direction = -1;
+    } else if (brightness <= 0) {
+        brightness = 0;
+        direction = 1;
     }
     
-    timeClient = new NTPClient(ntpUDP, config.ntpServer, config.timezoneOffset);
-    timeClient->begin();
+    CRGB color = CHSV(160, 255, brightness);
+    publishFrame({clockFace->all, color, color, 255, TRANSITION_NONE, 0, 0});
 }
 
-void cleanupWiFi() {
-    if (timeClient != nullptr) {
-        timeClient->end();
-        delete timeClient;
-        timeClient = nullptr;
+// ==================== TIMEZONE ====================
+// The rule parser and transition maths are in wordclock_core.h
+TzState tz = {{0, 0, false, {TZ_RULE_MONTH, 0, 0, 0, 0}, {TZ_RULE_MONTH, 0, 0, 0, 0}}, 0, false, 0, 0};
+
+int32_t tzOffsetAt(int64_t utc) {
+    if (utc >= tz.validUntil || utc < tz.validFrom) {
+        tzUpdate(tz, utc);
+    }
+    return tz.offset;
+}
+
+// Falls back to UTC when the rule does not parse
+bool tzBegin(const char* spec) {
+    TzRule rule;
+    bool ok = tzParse(spec, rule);
+    if (!ok) {
+        rule.stdOffset = 0;
+        rule.hasDst = false;
     }
     
-    ntpUDP.stop();
-    WiFi.disconnect(true);
-    WiFi.softAPdisconnect(true);
-    WiFi.mode(WIFI_OFF);
-    
-    wifiConnected = false;
+    tz.rule = rule;
+    tz.validFrom = 0;
+    tz.validUntil = 0;  // Forces tzUpdate() on the next lookup
+    return ok;
 }
 
-// ==================== DISPLAY FUNCTIONS ====================
-void displayTime() {
-    FastLED.clear();
-    displayAlwaysOn();
-    displayAMPM();
+// ==================== CLOCK ====================
+// The one time source: UTC in microseconds, anchored to the free-running
+// 64-bit hardware timer and stepped by NTP. Reading it is an add; local
+// fields are derived on demand and the calendar date is only recomputed
+// when the local day changes.
+struct WallClock {
+    int64_t offsetUs = 0;           // UTC us = time_us_64() + offsetUs (+ slew)
+    bool valid = false;             // Restored estimate or NTP time
+    bool synced = false;            // Confirmed by NTP since boot
+    int64_t slewUs = 0;             // Correction still being worked in
+    uint64_t slewStartUs = 0;
+    int64_t syncTimerUs = 0;        // Raw offset at the last NTP sync, for drift
+    int64_t syncOffsetUs = 0;
+    int32_t driftPpb = 0;           // Timer error, fast if positive
+    uint8_t driftSamples = 0;
+    uint64_t anchorUs = 0;          // Timer value where offsetUs holds exactly
+    int32_t cachedDay = INT32_MIN;  // Local day the cached date belongs to
+    int32_t year = 1970;
+    int8_t month = 1;
+    int8_t day = 1;
+    int8_t dotw = 4;
+};
+
+WallClock wallClock;
+alarm_id_t minuteAlarmId = 0;
+int64_t minuteBoundaryUs = 0;       // UTC of the boundary the alarm is armed for
+volatile bool minuteAlarmFired = false;
+unsigned long lastClockSnapshot = 0;
+
+// Offset at timer value now: the drift since the anchor is taken out
+// continuously, plus the part of the slew done so far
+int64_t clockOffsetUs(uint64_t now) {
+    int64_t offset = wallClock.offsetUs - (int64_t)(now - wallClock.anchorUs) * wallClock.driftPpb / 1000000000LL;
+    if (wallClock.slewUs == 0) return offset;
     
-    int displayHour = getDisplayHour();
-    displayHour_func(displayHour);
-    displayMinutes();
+    int64_t done = (int64_t)(now - wallClock.slewStartUs) * CLOCK_SLEW_PPM / 1000000;
+    if (done >= llabs(wallClock.slewUs)) return offset + wallClock.slewUs;
+    return offset + (wallClock.slewUs < 0 ? -done : done);
 }
 
-void displayAlwaysOn() {
-    for (int i = 0; i < 5; i++) {
-        leds[HETIS_LEDS[i]] = CRGB::Yellow;
-    }
+int64_t clockNowUs() {
+    uint64_t now = time_us_64();
+    return (int64_t)now + clockOffsetUs(now);
+}
+
+uint32_t clockNow() {
+    return clockNowUs() / 1000000;
+}
+
+void clockSet(int64_t utcUs) {
+    wallClock.anchorUs = time_us_64();
+    wallClock.offsetUs = utcUs - (int64_t)wallClock.anchorUs;
+    wallClock.slewUs = 0;
+    wallClock.valid = true;
+    minuteAlarmFired = false;   // A step may go back past the armed boundary
 }
 
-void displayAMPM() {
-    int hour = currentTime.hour;
-    int minute = currentTime.min;
+// NTP result: small errors are slewed in so the displayed time never
+// jumps back over a minute boundary, large ones step. A restored estimate
+// counts as a clock too, so a restart that kept the time is only slewed.
+// Returns how far off the drift-corrected clock was.
+int64_t clockCorrect(int64_t utcUs) {
+    uint64_t now = time_us_64();
+    int64_t rawOffset = utcUs - (int64_t)now;
+    int64_t currentOffset = clockOffsetUs(now);
+    int64_t error = rawOffset - currentOffset;
     
-    // Als we voorbij 17 minuten zijn, verwijzen we naar het volgende uur
-    if (minute > 17) {
-        hour++;
-        if (hour >= 24) hour = 0;
+    // Drift from how much the raw timer offset moved between syncs. The
+    // reference stays until the gap is long enough, so frequent corrections
+    // (LAN beacons) still measure it.
+    bool driftDue = (int64_t)now - wallClock.syncTimerUs >= CLOCK_DRIFT_MIN_INTERVAL;
+    if (wallClock.synced && driftDue) {
+        int64_t measured = -(rawOffset - wallClock.syncOffsetUs) * 1000000000LL / ((int64_t)now - wallClock.syncTimerUs);
+        if (wallClock.driftSamples == 0) {
+            wallClock.driftPpb = measured;
+        } else {
+            wallClock.driftPpb = (3 * (int64_t)wallClock.driftPpb + measured) / 4;
+        }
+        if (wallClock.driftSamples < 255) wallClock.driftSamples++;
+    }
+    if (!wallClock.synced || driftDue) {
+        wallClock.syncTimerUs = now;
+        wallClock.syncOffsetUs = rawOffset;
     }
     
-    if (hour < 12) {
-        leds[AM_LED] = CRGB::White;
+    if (!wallClock.valid || llabs(error) > CLOCK_STEP_LIMIT_US) {
+        clockSet(utcUs);
     } else {
-        leds[PM_LED] = CRGB::White;
+        wallClock.offsetUs = currentOffset;
+        wallClock.anchorUs = now;
+        wallClock.slewUs = error;
+        wallClock.slewStartUs = now;
     }
+    wallClock.synced = true;
+    return error;
 }
 
-int getDisplayHour() {
-    int hour = currentTime.hour;
-    int minute = currentTime.min;
-    
-    if (hour == 0) hour = 12;
-    else if (hour > 12) hour -= 12;
-    
-    if (minute > 17) {
-        hour++;
-        if (hour > 12) hour = 1;
+// The watchdog scratch registers keep their value through a watchdog or
+// software reboot, not a power cycle. Rewritten every second and right
+// before a requested restart, so a warm reboot loses at most that much.
+void clockScratchSave() {
+    if (!wallClock.valid) return;
+    uint64_t utcUs = clockNowUs();
+    uint32_t low = (uint32_t)utcUs;
+    uint32_t high = (uint32_t)(utcUs >> 32);
+    watchdog_hw->scratch[0] = 0;    // Invalid while half written
+    watchdog_hw->scratch[1] = low;
+    watchdog_hw->scratch[2] = high;
+    watchdog_hw->scratch[3] = CLOCK_SCRATCH_MAGIC ^ low ^ high;
+    watchdog_hw->scratch[0] = CLOCK_SCRATCH_MAGIC;
+}
+
+// The timer restarts at zero with the chip, so time_us_64() is the time
+// since the reboot
+bool clockScratchRestore(int64_t& utcUs) {
+    uint32_t low = watchdog_hw->scratch[1];
+    uint32_t high = watchdog_hw->scratch[2];
+    if (watchdog_hw->scratch[0] != CLOCK_SCRATCH_MAGIC || watchdog_hw->scratch[3] != (CLOCK_SCRATCH_MAGIC ^ low ^ high)) {
+        return false;
     }
-    
-    return hour;
+    utcUs = (int64_t)(((uint64_t)high << 32) | low) + (int64_t)time_us_64();
+    return true;
 }
 
-void displayHour_func(int hour) {
-    if (hour < 1 || hour > 12) return;
+// Continues from the last snapshot so something sensible is on the face
+// right after power-on; the time is off by however long the power was out.
+// After a warm reboot the scratch registers have the time much closer.
+void clockRestore() {
+    const Journal& journal = clockJournal;
+    const JournalHeader* header = journal.newestSlot >= 0 ? journalSlot(journal, journal.newestSlot) : nullptr;
+    if (header && header->version == CLOCK_SNAPSHOT_VERSION && header->length == sizeof(ClockSnapshot)) {
+        ClockSnapshot snapshot;
+        memcpy(&snapshot, header + 1, sizeof(snapshot));
+        clockSet(snapshot.utcUs);
+        wallClock.driftPpb = snapshot.driftPpb;
+        wallClock.driftSamples = snapshot.driftPpb != 0;
+        logPrintf("Clock restored from snapshot, drift %ld ppb\n", (long)snapshot.driftPpb);
+    }
     
-    int hourIndex = (hour == 12) ? 0 : hour;
+    int64_t warmUs;
+    if (clockScratchRestore(warmUs)) {
+        clockSet(warmUs);
+        logPrintf("Clock kept across the reboot\n");
+    }
+}
+
+void clockSnapshotSave() {
+    if (!wallClock.valid) return;
     
-    for (int i = 0; i < 3; i++) {
-        if (HOUR_LEDS[hourIndex][i] != -1) {
-            leds[HOUR_LEDS[hourIndex][i]] = CRGB::White;
-        }
+    ClockSnapshot snapshot = {clockNowUs(), wallClock.driftPpb, (uint32_t)wallClock.synced};
+    journalAppend(clockJournal, CLOCK_SNAPSHOT_VERSION, &snapshot, sizeof(snapshot));
+    lastClockSnapshot = millis();
+}
+
+void checkClockSnapshot() {
+    clockScratchSave();
+    if (wallClock.valid && millis() - lastClockSnapshot > CLOCK_SNAPSHOT_INTERVAL) {
+        clockSnapshotSave();
     }
 }
 
-void displayMinutes() {
-    int minute = currentTime.min;
+// Local time aheadUs from now
+void clockLocalTime(datetime_t& out, int64_t aheadUs) {
+    int64_t utc = (clockNowUs() + aheadUs) / 1000000;
+    int64_t local = utc + tzOffsetAt(utc);
+    int32_t days = local / 86400 - (local % 86400 < 0);
+    int32_t seconds = local - (int64_t)days * 86400;
     
-    if (minute == 0) {
-        lightUpWord(PRECIES_LEDS, 7);
-        // "Het is precies [uur] uur"
-        for (int i = 0; i < 3; i++) {
-            leds[UUR_LEDS[i]] = CRGB::White;
-        }
+    if (days != wallClock.cachedDay) {
+        int32_t year, month, day;
+        civilFromDays(days, year, month, day);
+        wallClock.year = year;
+        wallClock.month = month;
+        wallClock.day = day;
+        wallClock.dotw = ((days % 7) + 11) % 7;  // 1970-01-01 was a Thursday
+        wallClock.cachedDay = days;
     }
-    else if (minute >= 1 && minute <= 2) {
-        lightUpWord(RUIM_LEDS, 4);
-        lightUpWord(OVER_LEDS, 4);
+    
+    out.year = wallClock.year;
+    out.month = wallClock.month;
+    out.day = wallClock.day;
+    out.dotw = wallClock.dotw;
+    out.hour = seconds / 3600;
+    out.min = (seconds / 60) % 60;
+    out.sec = seconds % 60;
+}
+
+// ==================== TIME FUNCTIONS ====================
+int64_t applyNTPTime(int64_t utcUs) {
+    bool firstSync = !wallClock.synced;
+    int64_t error = clockCorrect(utcUs);
+    logPrintf("Clock off by %ld ms, drift %ld ppb\n", (long)(error / 1000), (long)wallClock.driftPpb);
+    if (firstSync) clockSnapshotSave();
+    requestDisplayUpdate();
+    adaptNTPInterval(error, firstSync);
+    return error;
+}
+
+// Doubles the interval while the drift-corrected clock stays within the
+// target, halves it when it doesn't
+void adaptNTPInterval(int64_t errorUs, bool firstSync) {
+    if (firstSync || llabs(errorUs) > NTP_TARGET_ERROR_US) {
+        ntp.interval = max(ntp.interval / 2, (unsigned long)NTP_INTERVAL_MIN);
+    } else if (wallClock.driftSamples > 0) {
+        ntp.interval = min(ntp.interval * 2, (unsigned long)NTP_INTERVAL_MAX);
     }
-    else if (minute >= 3 && minute <= 4) {
-        lightUpWord(BIJNA_LEDS, 4);
-        leds[VIJF_MIN_LED] = CRGB::White;
-        lightUpWord(OVER_LEDS, 4);
+    logPrintf("Next NTP sync in %lu min\n", ntp.interval / 60000);
+}
+
+// Runs in the lwIP context
+void ntpDnsFound(const char* name, const ip_addr_t* addr, void* arg) {
+    // A lookup for a server that has since been changed
+    if (strcmp(name, config.ntpServer) != 0) return;
+    if (addr != nullptr) {
+        ntp.serverIP = IPAddress(ip4_addr_get_u32(ip_2_ip4(addr)));
+        ntp.dnsResolved = true;
+    }
+    ntp.dnsDone = true;
+}
+
+// Starts a sync; the exchange itself is driven by checkNTPSync()
+void syncTimeWithNTP() {
+    if (!wifiConnected) return;
+    if (ntp.state == NTP_RESOLVING || ntp.state == NTP_WAITING) return;
+    
+    ntp.dnsDone = false;
+    ntp.dnsResolved = false;
+    ntp.state = NTP_RESOLVING;
+    ntp.stateSince = millis();
+    
+    ip_addr_t addr;
+    err_t err = dns_gethostbyname(config.ntpServer, &addr, ntpDnsFound, nullptr);
+    if (err == ERR_OK) {
+        ntpDnsFound(config.ntpServer, &addr, nullptr);
+    } else if (err != ERR_INPROGRESS) {
+        retryNTPLater();
+    }
+}
+
+void sendNTPRequest() {
+    uint8_t packet[NTP_PACKET_SIZE] = {0};
+    packet[0] = 0b11100011;   // LI unsynchronised, version 4, client mode
+    packet[2] = 6;            // Poll interval
+    packet[3] = 0xEC;         // Precision
+    
+    // Random transmit timestamp, the server must echo it as originate
+    ntp.requestCookie = rp2040.hwrand32();
+    packet[40] = ntp.requestCookie >> 24;
+    packet[41] = ntp.requestCookie >> 16;
+    packet[42] = ntp.requestCookie >> 8;
+    packet[43] = ntp.requestCookie;
+    
+    // Drop stale replies from an earlier attempt
+    while (ntpUDP.parsePacket() > 0) {
+    }
+    
+    ntpUDP.beginPacket(ntp.serverIP, NTP_PORT);
+    ntpUDP.write(packet, NTP_PACKET_SIZE);
+    ntp.sentAtUs = clockNowUs();
+    ntpUDP.endPacket();
+    trace(TRACE_NTP_SENT);
+    
+    ntp.state = NTP_WAITING;
+    ntp.stateSince = millis();
+}
+
+// 64-bit NTP timestamp to Unix microseconds; unsigned maths keeps
+// working past the 2036 era rollover
+int64_t ntpTimestampUs(const uint8_t* field) {
+    uint32_t seconds = ((uint32_t)field[0] << 24) | ((uint32_t)field[1] << 16) |
+                       ((uint32_t)field[2] << 8) | field[3];
+    uint32_t fraction = ((uint32_t)field[4] << 24) | ((uint32_t)field[5] << 16) |
+                        ((uint32_t)field[6] << 8) | field[7];
+    return (int64_t)(uint32_t)(seconds - NTP_UNIX_OFFSET) * 1000000 + (((uint64_t)fraction * 1000000) >> 32);
+}
+
+// On-wire SNTP: offset = ((T2 - T1) + (T3 - T4)) / 2 and
+// delay = (T4 - T1) - (T3 - T2), with T1/T4 on the local clock
+bool readNTPResponse(int64_t& utcUs) {
+    int64_t receivedAtUs = clockNowUs();
+    uint8_t packet[NTP_PACKET_SIZE];
+    if (ntpUDP.read(packet, NTP_PACKET_SIZE) != NTP_PACKET_SIZE) return false;
+    
+    uint8_t leap = packet[0] >> 6;
+    uint8_t mode = packet[0] & 0x07;
+    uint8_t stratum = packet[1];
+    uint32_t originate = ((uint32_t)packet[24] << 24) | ((uint32_t)packet[25] << 16) |
+                         ((uint32_t)packet[26] << 8) | packet[27];
+    uint32_t transmit = ((uint32_t)packet[40] << 24) | ((uint32_t)packet[41] << 16) |
+                        ((uint32_t)packet[42] << 8) | packet[43];
+    
+    if (mode != 4 || leap == 3 || stratum == 0 || stratum > 15) return false;
+    if (originate != ntp.requestCookie || transmit == 0) return false;
+    
+    int64_t serverReceiveUs = ntpTimestampUs(packet + 32);
+    int64_t serverTransmitUs = ntpTimestampUs(packet + 40);
+    int64_t offset = ((serverReceiveUs - ntp.sentAtUs) + (serverTransmitUs - receivedAtUs)) / 2;
+    int64_t delay = (receivedAtUs - ntp.sentAtUs) - (serverTransmitUs - serverReceiveUs);
+    if (delay > NTP_MAX_DELAY_US) return false;
+    
+    ntp.lastOffsetUs = constrain(offset, (int64_t)INT32_MIN, (int64_t)INT32_MAX);
+    ntp.lastDelayUs = max(delay, (int64_t)0);
+    metrics.ntpSyncs++;
+    trace(TRACE_NTP_RECEIVED, 0, (uint32_t)ntp.lastOffsetUs);
+    metricsObserve(metrics.ntpDelay, ntp.lastDelayUs);
+    metricsObserve(metrics.ntpOffset, (uint32_t)min(llabs(offset), (int64_t)UINT32_MAX));
+    utcUs = receivedAtUs + offset;
+    ntp.synced = true;
+    return true;
+}
+
+void retryNTPLater() {
+    metrics.ntpFailures++;
+    trace(TRACE_NTP_FAILED);
+    ntp.state = NTP_BACKOFF;
+    ntp.stateSince = millis();
+    logPrintf("NTP sync failed, retrying in %lu ms\n", ntp.retryDelay);
+}
+
+// Runs in the timer interrupt at every local hh:mm:00
+int64_t onMinuteAlarm(alarm_id_t id, void* userData) {
+    minuteAlarmId = 0;
+    minuteAlarmFired = true;
+    displayUpdatePending = true;
+    taskKick(TASK_DISPLAY);
+    return 0;
+}
+
+// How long before a minute boundary its frame has to start: the whole
+// transition, so the new words are fully in at hh:mm:00.000
+int64_t displayLeadUs() {
+    int64_t transitionUs = (config.transitionStyle != TRANSITION_NONE) ? config.transitionMs * 1000LL : 0;
+    return transitionUs + DISPLAY_LATENCY_US;
+}
+
+// One-shot hardware timer alarm at the next local minute boundary minus
+// the lead; re-armed after every redraw so clock steps are picked up.
+// The frame for that minute is handed to core 1 up front, which starts it
+// at the exact timer value however busy loop() is by then. afterUs keeps
+// the alarm path from arming the boundary it has just fired for.
+void armMinuteAlarm(int64_t afterUs) {
+    if (!wallClock.valid) return;
+    if (minuteAlarmId > 0) cancel_alarm(minuteAlarmId);
+    
+    uint64_t now = time_us_64();
+    int64_t clockOffset = clockOffsetUs(now);
+    int64_t utcUs = (int64_t)now + clockOffset;
+    int64_t leadUs = displayLeadUs();
+    int64_t tzUs = (int64_t)tzOffsetAt((utcUs + leadUs) / 1000000) * 1000000;
+    int64_t nextMinuteUs = ((utcUs + leadUs + tzUs) / 60000000 + 1) * 60000000 - tzUs;
+    if (nextMinuteUs <= afterUs) nextMinuteUs = afterUs + 60000000;
+    minuteBoundaryUs = nextMinuteUs;
+    uint64_t fireAt = nextMinuteUs - leadUs - clockOffset;
+    
+    datetime_t next;
+    clockLocalTime(next, nextMinuteUs - utcUs);
+    Frame frame = timeFrame(next);
+    frame.showAtUs = fireAt;
+    scheduleFrame(frame);
+    
+    minuteAlarmId = add_alarm_at(from_us_since_boot(fireAt), onMinuteAlarm, nullptr, true);
+}
+
+void requestDisplayUpdate() {
+    displayUpdatePending = true;
+    taskKick(TASK_DISPLAY);
+}
+
+void checkNTPSync() {
+    unsigned long now = millis();
+    
+    switch (ntp.state) {
+        case NTP_IDLE:
+            if (now - lastNTPSync > ntp.interval) {
+                syncTimeWithNTP();
+            }
+            break;
+            
+        case NTP_RESOLVING:
+            if (ntp.dnsDone) {
+                if (ntp.dnsResolved) {
+                    sendNTPRequest();
+                } else {
+                    retryNTPLater();
+                }
+            } else if (now - ntp.stateSince > NTP_DNS_TIMEOUT) {
+                retryNTPLater();
+            }
+            break;
+            
+        case NTP_WAITING: {
+            int64_t utcUs;
+            if (ntpUDP.parsePacket() > 0 && readNTPResponse(utcUs)) {
+                lastNTPSync = now;
+                ntp.state = NTP_IDLE;
+                ntp.retryDelay = NTP_RETRY_MIN;
+                applyNTPTime(utcUs);
+            } else if (now - ntp.stateSince > NTP_RESPONSE_TIMEOUT) {
+                retryNTPLater();
+            }
+            break;
+        }
+            
+        case NTP_BACKOFF:
+            if (now - ntp.stateSince > ntp.retryDelay) {
+                ntp.retryDelay = min(ntp.retryDelay * 2, (unsigned long)NTP_RETRY_MAX);
+                ntp.state = NTP_IDLE;
+                syncTimeWithNTP();
+            }
+            break;
+    }
+}
+
+void getCurrentTime(int64_t aheadUs) {
+    if (wallClock.valid) {
+        clockLocalTime(currentTime, aheadUs);
+    }
+}
+
+// ==================== LAN TIME ====================
+// Beacons are multicast every LAN_BEACON_INTERVAL by the leader, signed
+// with HMAC-SHA256 keyed by the WiFi password, so only clocks that could
+// join the network can steer the others. A follower takes the least
+// delayed sample (largest offset) out of each LAN_SAMPLE_WINDOW beacons:
+// queueing only ever delays a beacon, and with the radio in power save the
+// AP holds multicast until the next DTIM. That sample goes through
+// clockCorrect() like an NTP reply, slewed and with the drift measured
+// over longer gaps.
+
+// Only the leader, or every clock without LAN time, talks to NTP
+bool ntpActive() {
+    return !config.lanTime || lan.role == LAN_LEADER;
+}
+
+void lanTimeMac(const LanBeacon& beacon, uint8_t* out) {
+    br_hmac_context ctx;
+    br_hmac_init(&ctx, &lan.key, LAN_MAC_BYTES);
+    br_hmac_update(&ctx, &beacon, offsetof(LanBeacon, mac));
+    br_hmac_out(&ctx, out);
+}
+
+void lanTimeSetRole(LanTimeRole role) {
+    if (role == lan.role) return;
+    logPrintf("LAN time: %s -> %s\n", LAN_ROLE_NAMES[lan.role], LAN_ROLE_NAMES[role]);
+    trace(TRACE_LAN_ROLE, role);
+    lan.role = role;
+    lan.roleSince = millis();
+    lan.timeout = LAN_LEADER_TIMEOUT + rp2040.hwrand32() % LAN_ELECTION_JITTER;
+    lan.samples = 0;
+    
+    if (role == LAN_LEADER) {
+        // Fail-over: the sync interval carries on from the drift already known
+        initializeNTPClient();
+        syncTimeWithNTP();
+    }
+}
+
+// On link up, with config.lanTime set
+void lanTimeBegin() {
+    pico_unique_board_id_t id;
+    pico_get_unique_board_id(&id);
+    memcpy(&lan.nodeId, id.id, sizeof(lan.nodeId));
+    br_hmac_key_init(&lan.key, &br_sha256_vtable, config.password, strlen(config.password));
+    
+    lanUDP.stop();
+    if (!lanUDP.beginMulticast(LAN_TIME_GROUP, LAN_TIME_PORT)) {
+        logPrintf("LAN time: multicast join failed, using NTP\n");
+        lanTimeSetRole(LAN_LEADER);
+        return;
+    }
+    lan.leaderId = 0;
+    lan.leaderUtcUs = 0;
+    lan.lastBeaconAt = millis();
+    lanTimeSetRole(LAN_LISTENING);
+}
+
+void lanTimeStop() {
+    if (lan.role == LAN_OFF) return;
+    lanUDP.stop();
+    lanTimeSetRole(LAN_OFF);
+}
+
+void lanTimeSend() {
+    LanBeacon beacon = {};
+    beacon.magic = LAN_BEACON_MAGIC;
+    beacon.version = LAN_BEACON_VERSION;
+    beacon.flags = wallClock.synced ? LAN_BEACON_SYNCED : 0;
+    beacon.intervalMs = LAN_BEACON_INTERVAL;
+    beacon.nodeId = lan.nodeId;
+    beacon.utcUs = clockNowUs();
+    lanTimeMac(beacon, beacon.mac);
+    
+    lanUDP.beginPacketMulticast(LAN_TIME_GROUP, LAN_TIME_PORT, WiFi.localIP());
+    lanUDP.write((const uint8_t*)&beacon, sizeof(beacon));
+    lanUDP.endPacket();
+    lan.sent++;
+    lan.lastSentAt = millis();
+    trace(TRACE_LAN_BEACON, 0);
+}
+
+void lanTimeApply(int64_t offsetUs) {
+    bool firstSync = !wallClock.synced;
+    int64_t error = clockCorrect(clockNowUs() + offsetUs);
+    trace(TRACE_LAN_BEACON, 1, (uint32_t)constrain(error, (int64_t)INT32_MIN, (int64_t)INT32_MAX));
+    if (firstSync) {
+        logPrintf("Clock set from LAN leader, off by %ld ms\n", (long)(error / 1000));
+        clockSnapshotSave();
+    }
+    requestDisplayUpdate();
+}
+
+void lanTimeReceive(const LanBeacon& beacon, int64_t receivedAtUs) {
+    uint8_t mac[LAN_MAC_BYTES];
+    lanTimeMac(beacon, mac);
+    if (beacon.magic != LAN_BEACON_MAGIC || beacon.version != LAN_BEACON_VERSION ||
+        memcmp(mac, beacon.mac, sizeof(mac)) != 0) {
+        lan.rejected++;
+        return;
+    }
+    if (beacon.nodeId == lan.nodeId) return;  // Multicast loopback
+    if (!(beacon.flags & LAN_BEACON_SYNCED)) return;
+    
+    // Old beacons replayed from another clock ID would still carry a valid MAC
+    int64_t offset = beacon.utcUs + LAN_LATENCY_US - receivedAtUs;
+    if (wallClock.synced && llabs(offset) > LAN_MAX_OFFSET_US) {
+        lan.rejected++;
+        return;
+    }
+    
+    if (lan.role == LAN_LEADER) {
+        // Two leaders after a partition heals: the higher ID steps down
+        if (beacon.nodeId > lan.nodeId) return;
+        lanTimeSetRole(LAN_FOLLOWER);
+    } else if (beacon.nodeId != lan.leaderId) {
+        // A lower ID wins, anyone else is only taken once ours went quiet
+        bool leaderLost = millis() - lan.lastBeaconAt > lan.timeout;
+        if (lan.leaderId != 0 && beacon.nodeId > lan.leaderId && !leaderLost) return;
+        lanTimeSetRole(LAN_FOLLOWER);
+    }
+    if (beacon.nodeId != lan.leaderId) {
+        logPrintf("LAN time: following %08lx%08lx\n", (unsigned long)(beacon.nodeId >> 32), (unsigned long)beacon.nodeId);
+        lan.leaderId = beacon.nodeId;
+        lan.leaderUtcUs = 0;
+        lan.samples = 0;
+    }
+    
+    // A recorded beacon played back later carries an older leader time
+    if (beacon.utcUs <= lan.leaderUtcUs) {
+        lan.rejected++;
+        return;
+    }
+    lan.leaderUtcUs = beacon.utcUs;
+    lan.lastBeaconAt = millis();
+    lan.received++;
+    
+    if (lan.samples == 0 || offset > lan.bestOffsetUs) lan.bestOffsetUs = offset;
+    lan.samples++;
+    
+    // Without a synced clock the first beacon is good enough to show the time
+    if (lan.samples >= LAN_SAMPLE_WINDOW || !wallClock.synced) {
+        lanTimeApply(lan.bestOffsetUs);
+        lan.samples = 0;
+    }
+}
+
+// From loop() while connected with config.lanTime set
+void lanTimeService() {
+    if (lan.role == LAN_OFF) return;
+    
+    LanBeacon beacon;
+    while (lanUDP.parsePacket() > 0) {
+        int64_t receivedAtUs = clockNowUs();
+        if (lanUDP.read((uint8_t*)&beacon, sizeof(beacon)) == sizeof(beacon) && lanUDP.available() == 0) {
+            lanTimeReceive(beacon, receivedAtUs);
+        } else {
+            lan.rejected++;
+        }
+    }
+    
+    unsigned long now = millis();
+    if (lan.role == LAN_LEADER) {
+        if (wallClock.synced && now - lan.lastSentAt >= LAN_BEACON_INTERVAL) lanTimeSend();
+    } else if (now - lan.lastBeaconAt > lan.timeout && now - lan.roleSince > lan.timeout) {
+        logPrintf("LAN time: no leader, taking over\n");
+        lan.leaderId = 0;
+        lanTimeSetRole(LAN_LEADER);
+    }
+}
+
+// ==================== LAYOUT FUNCTIONS ====================
+bool layoutFail(const char* reason) {
+    logPrintf("Layout: %s, using built-in face\n", reason);
+    return false;
+}
+
+bool loadLayout(const char* path, ClockFace& face) {
+    File file = LittleFS.open(path, "r");
+    if (!file) return false;
+    
+    LayoutHeader header;
+    LayoutSpan words[LAYOUT_MAX_WORDS];
+    uint32_t hourSets[12];
+    uint32_t minuteSets[60];
+    
+    if (file.read((uint8_t*)&header, sizeof(header)) != sizeof(header)) return layoutFail("short header");
+    if (header.magic != LAYOUT_MAGIC || header.version != LAYOUT_VERSION) return layoutFail("unknown format");
+    if (header.numLeds == 0 || header.numLeds > MAX_LEDS) return layoutFail("bad LED count");
+    if (header.wordCount == 0 || header.wordCount > LAYOUT_MAX_WORDS) return layoutFail("bad word count");
+    if (header.hourAdvance > 60) return layoutFail("bad hour advance");
+    
+    size_t spanBytes = header.wordCount * sizeof(LayoutSpan);
+    if (file.read((uint8_t*)words, spanBytes) != spanBytes ||
+        file.read((uint8_t*)hourSets, sizeof(hourSets)) != sizeof(hourSets) ||
+        file.read((uint8_t*)minuteSets, sizeof(minuteSets)) != sizeof(minuteSets)) {
+        return layoutFail("truncated");
+    }
+    
+    uint32_t crc = crc32Update(0, &header, sizeof(header));
+    crc = crc32Update(crc, words, spanBytes);
+    crc = crc32Update(crc, hourSets, sizeof(hourSets));
+    crc = crc32Update(crc, minuteSets, sizeof(minuteSets));
+    uint32_t storedCrc;
+    if (file.read((uint8_t*)&storedCrc, sizeof(storedCrc)) != sizeof(storedCrc) || storedCrc != crc) {
+        return layoutFail("CRC mismatch");
+    }
+    
+    FrameMask wordMasks[LAYOUT_MAX_WORDS];
+    for (int w = 0; w < header.wordCount; w++) {
+        if (words[w].count == 0 || words[w].first + words[w].count > header.numLeds) return layoutFail("word outside strip");
+        wordMasks[w] = allLedsMask(words[w].count) << words[w].first;
+    }
+    
+    uint32_t validWords = (header.wordCount == 32) ? ~0UL : (1UL << header.wordCount) - 1;
+    auto setMask = [&](uint32_t set) {
+        FrameMask mask = 0;
+        for (int w = 0; w < header.wordCount; w++) {
+            if (set & (1UL << w)) mask |= wordMasks[w];
+        }
+        return mask;
+    };
+    auto specialMask = [&](uint8_t word) {
+        return (word < header.wordCount) ? wordMasks[word] : FrameMask(0);
+    };
+    
+    for (int h = 0; h < 12; h++) {
+        if (hourSets[h] & ~validWords) return layoutFail("unknown word in hour");
+        face.hours[h] = setMask(hourSets[h]);
+    }
+    for (int m = 0; m < 60; m++) {
+        if (minuteSets[m] & ~validWords) return layoutFail("unknown word in minute");
+        face.minutes[m] = setMask(minuteSets[m]);
+    }
+    
+    memcpy(face.name, header.name, sizeof(face.name) - 1);
+    face.name[sizeof(face.name) - 1] = '\0';
+    face.numLeds = header.numLeds;
+    face.hourAdvance = header.hourAdvance;
+    face.alwaysOn = specialMask(header.alwaysOnWord);
+    face.am = specialMask(header.amWord);
+    face.pm = specialMask(header.pmWord);
+    face.all = allLedsMask(header.numLeds);
+    return true;
+}
+
+// Switches to the layout file when there is a valid one
+void layoutBegin() {
+    if (!LittleFS.begin()) {
+        logPrintf("LittleFS mount failed, using built-in face\n");
+        return;
+    }
+    
+    if (loadLayout(LAYOUT_FILE, loadedFace)) {
+        std::atomic_thread_fence(std::memory_order_release);
+        clockFace = &loadedFace;
+    }
+    logPrintf("Clock face: %s (%d LEDs)\n", clockFace->name, clockFace->numLeds);
+}
+
+// ==================== CRC32 ====================
+// IEEE 802.3 CRC32 (as zlib). Large blocks go through the DMA sniffer,
+// which checksums whatever a channel reads at bus speed; that works on
+// RAM and on flash through XIP. crcStart() runs in the background,
+// crc32Update() waits for the result. Core 0 only.
+struct CrcJob {
+    int channel = -1;
+    bool active = false;
+    bool dma = false;
+    uint32_t crc = 0;            // Running value when no DMA is involved
+    const uint8_t* tail = nullptr;
+    size_t tailLength = 0;
+};
+
+CrcJob crcJob;
+
+uint32_t crc32Software(uint32_t crc, const void* data, size_t length) {
+    // Reflected polynomial 0xEDB88320, one nibble at a time
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    const uint8_t* bytes = (const uint8_t*)data;
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ bytes[i]) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (bytes[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+uint32_t bitReverse32(uint32_t value) {
+    value = ((value >> 1) & 0x55555555) | ((value & 0x55555555) << 1);
+    value = ((value >> 2) & 0x33333333) | ((value & 0x33333333) << 2);
+    value = ((value >> 4) & 0x0F0F0F0F) | ((value & 0x0F0F0F0F) << 4);
+    return __builtin_bswap32(value);
+}
+
+// Streams flash through the uncached alias so a big image doesn't evict
+// the code from the XIP cache
+const void* crcSource(const void* data) {
+    uintptr_t address = (uintptr_t)data;
+    if (address >= XIP_BASE && address < XIP_NOALLOC_BASE) {
+        return (const void*)(address - XIP_BASE + XIP_NOCACHE_NOALLOC_BASE);
+    }
+    return data;
+}
+
+// Continues crc over data. The unaligned head is done here in software,
+// the aligned words by DMA and the tail in crcResult().
+bool crcStart(uint32_t crc, const void* data, size_t length) {
+    if (crcJob.active) return false;
+    if (crcJob.channel < 0) crcJob.channel = dma_claim_unused_channel(false);
+    if (crcJob.channel < 0) return false;
+    
+    const uint8_t* bytes = (const uint8_t*)data;
+    size_t head = min((size_t)(-(uintptr_t)bytes & 3), length);
+    crc = crc32Software(crc, bytes, head);
+    bytes += head;
+    length -= head;
+    
+    size_t words = length / 4;
+    crcJob.tail = bytes + words * 4;
+    crcJob.tailLength = length & 3;
+    crcJob.crc = crc;
+    crcJob.dma = words > 0;
+    crcJob.active = true;
+    if (!crcJob.dma) return true;
+    
+    static uint32_t sink;
+    dma_channel_config c = dma_channel_get_default_config(crcJob.channel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_sniff_enable(&c, true);
+    
+    // The accumulator runs MSB first on bit-reversed data: seed it with the
+    // reflected internal state and let the output stage undo it on read
+    dma_sniffer_set_data_accumulator(bitReverse32(~crc));
+    dma_sniffer_set_output_reverse_enabled(true);
+    dma_sniffer_set_output_invert_enabled(true);
+    dma_sniffer_enable(crcJob.channel, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+    dma_channel_configure(crcJob.channel, &c, &sink, crcSource(bytes), words, true);
+    return true;
+}
+
+bool crcBusy() {
+    return crcJob.active && crcJob.dma && dma_channel_is_busy(crcJob.channel);
+}
+
+uint32_t crcResult() {
+    uint32_t crc = crcJob.crc;
+    if (crcJob.dma) {
+        dma_channel_wait_for_finish_blocking(crcJob.channel);
+        crc = dma_sniffer_get_data_accumulator();
+        dma_sniffer_disable();
+    }
+    crcJob.active = false;
+    return crc32Software(crc, crcJob.tail, crcJob.tailLength);
+}
+
+uint32_t crc32Update(uint32_t crc, const void* data, size_t length) {
+    if (length < CRC_DMA_MIN_BYTES || !crcStart(crc, data, length)) {
+        return crc32Software(crc, data, length);
+    }
+    return crcResult();
+}
+
+// ==================== CONFIG JOURNAL ====================
+// Append-only logs of records in the flash sectors just below LittleFS:
+// the config journal, and under it the clock snapshots. A write programs
+// one slot; a sector is only erased when the log wraps into it. On boot
+// the newest record with a valid CRC wins, so a torn write leaves the
+// previous one. With two sectors or more the erased one never holds the
+// newest record, so a power loss during the erase keeps it as well.
+extern uint8_t _FS_start;
+extern uint8_t __flash_binary_end;
+
+static_assert(JOURNAL_SECTORS >= 2 && CLOCK_JOURNAL_SECTORS >= 2, "a wrap must not erase the newest record");
+
+int journalSlotsPerSector(const Journal& journal) {
+    return FLASH_SECTOR_SIZE / journal.slotSize;
+}
+
+int journalSlots(const Journal& journal) {
+    return journal.sectors * journalSlotsPerSector(journal);
+}
+
+const JournalHeader* journalSlot(const Journal& journal, int slot) {
+    return (const JournalHeader*)(journal.base + slot * journal.slotSize);
+}
+
+uint32_t journalCrc(const JournalHeader* header, const void* payload) {
+    uint32_t crc = crc32Update(0, header, offsetof(JournalHeader, crc));
+    return crc32Update(crc, payload, header->length);
+}
+
+bool journalRecordValid(const Journal& journal, int slot) {
+    const JournalHeader* header = journalSlot(journal, slot);
+    if (header->magic != JOURNAL_MAGIC) return false;
+    if (header->length > journal.slotSize - sizeof(JournalHeader)) return false;
+    return header->crc == journalCrc(header, header + 1);
+}
+
+bool journalBlank(const uint8_t* address, size_t length) {
+    const uint32_t* words = (const uint32_t*)address;
+    for (size_t i = 0; i < length / 4; i++) {
+        if (words[i] != 0xFFFFFFFF) return false;
+    }
+    return true;
+}
+
+// Finds the newest record by reading the headers in place through XIP
+void journalBegin(Journal& journal, uintptr_t start) {
+    journal.base = (const uint8_t*)start;
+    
+    for (int slot = 0; slot < journalSlots(journal); slot++) {
+        if (!journalRecordValid(journal, slot)) continue;
+        uint32_t sequence = journalSlot(journal, slot)->sequence;
+        if (journal.newestSlot < 0 || (int32_t)(sequence - journal.sequence) > 0) {
+            journal.newestSlot = slot;
+            journal.sequence = sequence;
+        }
+    }
+}
+
+void journalsBegin() {
+    uintptr_t configStart = (uintptr_t)&_FS_start - JOURNAL_SECTORS * FLASH_SECTOR_SIZE;
+    uintptr_t clockStart = configStart - CLOCK_JOURNAL_SECTORS * FLASH_SECTOR_SIZE;
+    if ((uintptr_t)&__flash_binary_end > clockStart) {
+        logPrintf("Journals would overlap the sketch, using EEPROM\n");
+        return;
+    }
+    
+    journalBegin(configJournal, configStart);
+    journalBegin(clockJournal, clockStart);
+}
+
+bool journalAppend(Journal& journal, uint16_t version, const void* payload, uint16_t length) {
+    if (!journal.base || length > journal.slotSize - sizeof(JournalHeader)) return false;
+    
+    int perSector = journalSlotsPerSector(journal);
+    int slot = (journal.newestSlot + 1) % journalSlots(journal);
+    if (slot % perSector != 0 && !journalBlank((const uint8_t*)journalSlot(journal, slot), journal.slotSize)) {
+        // Leftover of a torn write: move on to the next sector
+        slot = (slot / perSector + 1) * perSector % journalSlots(journal);
+    }
+    bool erase = slot % perSector == 0 &&
+                 !journalBlank((const uint8_t*)journalSlot(journal, slot), FLASH_SECTOR_SIZE);
+    
+    static uint8_t buffer[JOURNAL_SLOT_SIZE];
+    memset(buffer, 0xFF, journal.slotSize);
+    JournalHeader* header = (JournalHeader*)buffer;
+    header->magic = JOURNAL_MAGIC;
+    header->sequence = journal.sequence + 1;
+    header->version = version;
+    header->length = length;
+    memcpy(header + 1, payload, length);
+    header->crc = journalCrc(header, header + 1);
+    
+    // XIP is off while the flash is written, so core 1 has to wait in RAM
+    uint32_t offset = (uintptr_t)journalSlot(journal, slot) - XIP_BASE;
+    uint32_t startedAt = time_us_32();
+    rp2040.idleOtherCore();
+    noInterrupts();
+    if (erase) flash_range_erase(offset, FLASH_SECTOR_SIZE);
+    flash_range_program(offset, buffer, journal.slotSize);
+    interrupts();
+    rp2040.resumeOtherCore();
+    
+    metrics.flashWrites++;
+    if (erase) metrics.flashErases++;
+    trace(TRACE_FLASH_COMMIT, erase, time_us_32() - startedAt);
+    
+    if (!journalRecordValid(journal, slot)) return false;
+    journal.newestSlot = slot;
+    journal.sequence = header->sequence;
+    return true;
+}
+
+void journalErase(Journal& journal) {
+    if (!journal.base) return;
+    
+    rp2040.idleOtherCore();
+    noInterrupts();
+    flash_range_erase((uintptr_t)journal.base - XIP_BASE, journal.sectors * FLASH_SECTOR_SIZE);
+    interrupts();
+    rp2040.resumeOtherCore();
+    metrics.flashErases += journal.sectors;
+    
+    journal.newestSlot = -1;
+}
+
+// ==================== CONFIG FUNCTIONS ====================
+// Sums everything before the trailing checksum field (legacy EEPROM records)
+uint32_t calculateChecksum(const void* data, size_t length) {
+    uint32_t checksum = 0;
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < length - sizeof(uint32_t); i++) {
+        checksum += bytes[i];
+    }
+    return checksum;
+}
+
+// Turns the old fixed offset + EU DST flag into an equivalent TZ rule
+void migrateTimezone(int offset, bool daylightSaving, char* rule, size_t size) {
+    if (offset == 3600 && daylightSaving) {
+        strlcpy(rule, "CET-1CEST,M3.5.0,M10.5.0/3", size);
+        return;
+    }
+    if (offset == 0 && daylightSaving) {
+        strlcpy(rule, "GMT0BST,M3.5.0/1,M10.5.0", size);
+        return;
+    }
+    
+    int posix = -offset;  // POSIX counts west of UTC
+    char sign = posix < 0 ? '-' : '+';
+    int hours = abs(posix) / 3600;
+    int minutes = (abs(posix) % 3600) / 60;
+    char offsetText[8];
+    if (minutes != 0) {
+        snprintf(offsetText, sizeof(offsetText), "%c%d:%02d", sign, hours, minutes);
+    } else {
+        snprintf(offsetText, sizeof(offsetText), "%c%d", sign, hours);
+    }
+    
+    if (daylightSaving) {
+        snprintf(rule, size, "STD%sDST,M3.5.0/1,M10.5.0", offsetText);
+    } else {
+        snprintf(rule, size, "UTC%s", offsetText);
+    }
+}
+
+void setupEEPROM() {
+    EEPROM.begin(EEPROM_SIZE);
+    journalsBegin();
+}
+
+void applyConfigData(const ConfigData& data) {
+    strlcpy(config.ssid, data.ssid, sizeof(config.ssid));
+    strlcpy(config.password, data.password, sizeof(config.password));
+    strlcpy(config.ntpServer, data.ntpServer, sizeof(config.ntpServer));
+    strlcpy(config.timezone, data.timezone, sizeof(config.timezone));
+    config.brightness = data.brightness;
+    config.configured = data.configured;
+    config.transitionStyle = data.transitionStyle < TRANSITION_STYLE_COUNT ? data.transitionStyle : TRANSITION_FADE;
+    config.transitionMs = min(data.transitionMs, (uint16_t)TRANSITION_MAX_MS);
+    config.lanTime = data.flags & CONFIG_FLAG_LAN_TIME;
+}
+
+ConfigData makeConfigData() {
+    ConfigData data;
+    memset(&data, 0, sizeof(data));
+    strlcpy(data.ssid, config.ssid, sizeof(data.ssid));
+    strlcpy(data.password, config.password, sizeof(data.password));
+    strlcpy(data.ntpServer, config.ntpServer, sizeof(data.ntpServer));
+    strlcpy(data.timezone, config.timezone, sizeof(data.timezone));
+    data.brightness = config.brightness;
+    data.configured = config.configured;
+    data.transitionStyle = config.transitionStyle;
+    data.transitionMs = config.transitionMs;
+    data.flags = config.lanTime ? CONFIG_FLAG_LAN_TIME : 0;
+    return data;
+}
+
+// Reads whatever an older firmware left in EEPROM
+bool loadLegacyConfiguration() {
+    EepromConfig eepromConfig;
+    EEPROM.get(CONFIG_ADDRESS, eepromConfig);
+    if (eepromConfig.checksum == calculateChecksum(&eepromConfig, sizeof(eepromConfig))) {
+        applyConfigData(eepromConfig.data);
+        return true;
+    }
+    
+    // The shipped layout keeps the default transition settings
+    ConfigDataV1 legacyConfig;
+    EEPROM.get(CONFIG_ADDRESS, legacyConfig);
+    if (legacyConfig.checksum == calculateChecksum(&legacyConfig, sizeof(legacyConfig))) {
+        strlcpy(config.ssid, legacyConfig.ssid, sizeof(config.ssid));
+        strlcpy(config.password, legacyConfig.password, sizeof(config.password));
+        strlcpy(config.ntpServer, legacyConfig.ntpServer, sizeof(config.ntpServer));
+        migrateTimezone(legacyConfig.timezoneOffset, legacyConfig.daylightSaving,
+                        config.timezone, sizeof(config.timezone));
+        config.brightness = legacyConfig.brightness;
+        config.configured = legacyConfig.configured;
+        return true;
+    }
+    
+    return false;
+}
+
+void clearLegacyConfiguration() {
+    for (int i = 0; i < EEPROM_SIZE; i++) EEPROM.write(i, 0xFF);
+    EEPROM.commit();
+}
+
+void loadConfiguration() {
+    logPrintf("Loading configuration...\n");
+    
+    if (configJournal.newestSlot >= 0) {
+        const JournalHeader* header = journalSlot(configJournal, configJournal.newestSlot);
+        const uint8_t* payload = (const uint8_t*)(header + 1);
+        
+        // Older record versions get a case here when ConfigData changes
+        switch (header->version) {
+            case CONFIG_VERSION:
+                if (header->length == sizeof(ConfigData)) {
+                    ConfigData data;
+                    memcpy(&data, payload, sizeof(data));
+                    applyConfigData(data);
+                    logPrintf("Configuration loaded from record %lu\n", (unsigned long)header->sequence);
+                    return;
+                }
+                break;
+        }
+        
+        logPrintf("Unsupported config record version %u, using defaults\n", header->version);
+        config.configured = false;
+        return;
+    }
+    
+    if (loadLegacyConfiguration()) {
+        logPrintf("Migrated EEPROM configuration, timezone %s\n", config.timezone);
+        // Move it into the journal so the old copy can go
+        ConfigData data = makeConfigData();
+        if (journalAppend(configJournal, CONFIG_VERSION, &data, sizeof(data))) {
+            clearLegacyConfiguration();
+        }
+        return;
+    }
+    
+    logPrintf("No stored configuration, using defaults\n");
+    config.configured = false;
+}
+
+void saveConfiguration() {
+    logPrintf("Saving configuration...\n");
+    
+    config.configured = true;
+    ConfigData data = makeConfigData();
+    
+    if (journalAppend(configJournal, CONFIG_VERSION, &data, sizeof(data))) {
+        logPrintf("Configuration saved as record %lu\n", (unsigned long)configJournal.sequence);
+        return;
+    }
+    
+    EepromConfig eepromConfig;
+    eepromConfig.data = data;
+    eepromConfig.checksum = calculateChecksum(&eepromConfig, sizeof(eepromConfig));
+    EEPROM.put(CONFIG_ADDRESS, eepromConfig);
+    EEPROM.commit();
+    logPrintf("Configuration saved to EEPROM\n");
+}
+
+void resetConfiguration() {
+    logPrintf("Resetting configuration...\n");
+    
+    // Erase rather than append, so old credentials don't stay in flash
+    if (configJournal.base) {
+        journalErase(configJournal);
+    } else {
+        clearLegacyConfiguration();
+    }
+    
+    memset(&config, 0, sizeof(config));
+    config.brightness = 64;
+    strcpy(config.ntpServer, "pool.ntp.org");
+    strcpy(config.timezone, TZ_DEFAULT);
+    config.configured = false;
+    config.transitionStyle = TRANSITION_FADE;
+    config.transitionMs = TRANSITION_DEFAULT_MS;
+    tzBegin(config.timezone);
+    
+    logPrintf("Configuration reset complete\n");
+}
+
+// ==================== CONFIG MANAGER ====================
+// Applies a changed configuration while running. Each field only touches
+// what depends on it: brightness and transitions show in the next frame,
+// a timezone re-arms the minute alarm, an NTP server restarts the SNTP
+// exchange, and only new WiFi credentials drop the connection.
+enum ConfigChange : uint8_t {
+    CONFIG_CHANGE_DISPLAY = 1 << 0,
+    CONFIG_CHANGE_TIMEZONE = 1 << 1,
+    CONFIG_CHANGE_NTP = 1 << 2,
+    CONFIG_CHANGE_WIFI = 1 << 3,
+    CONFIG_CHANGE_LAN_TIME = 1 << 4
+};
+
+uint8_t applyConfig(const Config& next) {
+    uint8_t changes = 0;
+    if (next.brightness != config.brightness || next.transitionStyle != config.transitionStyle ||
+        next.transitionMs != config.transitionMs) {
+        changes |= CONFIG_CHANGE_DISPLAY;
+    }
+    if (strcmp(next.timezone, config.timezone) != 0) changes |= CONFIG_CHANGE_TIMEZONE;
+    if (strcmp(next.ntpServer, config.ntpServer) != 0) changes |= CONFIG_CHANGE_NTP;
+    if (strcmp(next.ssid, config.ssid) != 0 || strcmp(next.password, config.password) != 0) {
+        changes |= CONFIG_CHANGE_WIFI;
+    }
+    if (next.lanTime != config.lanTime) changes |= CONFIG_CHANGE_LAN_TIME;
+    
+    bool firstSave = !config.configured;
+    config = next;
+    if (changes == 0 && !firstSave) return 0;
+    saveConfiguration();
+    
+    if (changes & CONFIG_CHANGE_TIMEZONE) {
+        tzBegin(config.timezone);
+    }
+    if (changes & CONFIG_CHANGE_DISPLAY) {
+        ambientBrightness = ambientTarget();
+    }
+    if (changes & (CONFIG_CHANGE_DISPLAY | CONFIG_CHANGE_TIMEZONE)) {
+        requestDisplayUpdate();
+    }
+    if ((changes & CONFIG_CHANGE_NTP) && wifiConnected && ntpActive()) {
+        initializeNTPClient();
+        syncTimeWithNTP();
+    }
+    // A WiFi change starts over on the new link anyway
+    if ((changes & CONFIG_CHANGE_LAN_TIME) && !(changes & CONFIG_CHANGE_WIFI) && wifiConnected) {
+        if (config.lanTime) {
+            lanTimeBegin();
+        } else {
+            lanTimeStop();
+            initializeNTPClient();
+            syncTimeWithNTP();
+        }
+    }
+    if ((changes & CONFIG_CHANGE_WIFI) && !configMode) {
+        configManager.rejoinPending = true;
+        taskKick(TASK_CONFIG);
+    }
+    
+    logPrintf("Configuration applied (changes 0x%02x)\n", changes);
+    return changes;
+}
+
+// Called at the top of the loop, outside any request handler
+// Handlers only ask for a restart, so they never wait for their reply
+// to drain; the config task restarts once RESTART_DELAY_MS has passed
+void requestRestart() {
+    configManager.restartPending = true;
+    configManager.restartAt = millis() + RESTART_DELAY_MS;
+    taskKick(TASK_CONFIG);
+}
+
+void applyPendingConfig() {
+    if (configManager.restartPending && (long)(millis() - configManager.restartAt) >= 0) {
+        clockSnapshotSave();
+        clockScratchSave();
+        rp2040.restart();
+    }
+    if (configManager.leavePortalPending) {
+        configManager.leavePortalPending = false;
+        leaveConfigMode();
+    }
+    if (configManager.rejoinPending) {
+        configManager.rejoinPending = false;
+        logPrintf("WiFi settings changed, joining %s\n", config.ssid);
+        ntpUDP.stop();
+        ntp.state = NTP_IDLE;
+        lanTimeStop();
+        if (wifiConnected) trace(TRACE_WIFI_LINK, 0);
+        wifiConnected = false;
+        WiFi.disconnect();
+        wifiManager.retryDelay = WIFI_RETRY_MIN;
+        if (!connectToWiFi()) wifiManager.state = LINK_IDLE;
+    }
+}
+
+// ==================== WIFI FUNCTIONS ====================
+// Starts joining config.ssid and returns; handleWiFi() follows it up
+bool connectToWiFi() {
+    if (strlen(config.ssid) == 0) {
+        return false;
+    }
+    
+    WiFi.mode(WIFI_STA);
+    WiFi.beginNoBlock(config.ssid, config.password);
+    
+    wifiManager.state = LINK_CONNECTING;
+    wifiManager.stateSince = millis();
+    return true;
+}
+
+// Association state comes from the CYW43 driver, the address from lwIP
+bool wifiLinkUp() {
+    int link = cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA);
+    return (link == CYW43_LINK_JOIN || link == CYW43_LINK_UP) && WiFi.status() == WL_CONNECTED;
+}
+
+void handleWiFi() {
+    unsigned long now = millis();
+    
+    switch (wifiManager.state) {
+        case LINK_IDLE:
+            break;
+            
+        case LINK_CONNECTING: {
+            if (wifiLinkUp()) {
+                if (wifiManager.everConnected) wifiManager.reconnects++;
+                wifiManager.everConnected = true;
+                wifiManager.state = LINK_CONNECTED;
+                trace(TRACE_WIFI_LINK, 1);
+                wifiManager.retryDelay = WIFI_RETRY_MIN;
+                wifiConnected = true;
+                
+                // The full web UI, also on the LAN
+                setupWebServer();
+                webServerBegin();
+                mdnsBegin();
+                
+                initializeNTPClient();
+                if (config.lanTime) {
+                    lanTimeBegin();
+                } else {
+                    syncTimeWithNTP();
+                }
+                break;
+            }
+            
+            int link = cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA);
+            if (link == CYW43_LINK_BADAUTH && !wifiManager.everConnected) {
+                // A wrong password will not fix itself
+                enterConfigMode();
+            } else if (link == CYW43_LINK_FAIL || link == CYW43_LINK_NONET ||
+                       link == CYW43_LINK_BADAUTH || now - wifiManager.stateSince > WIFI_TIMEOUT) {
+                WiFi.disconnect();
+                wifiManager.state = LINK_BACKOFF;
+                wifiManager.stateSince = now;
+            }
+            break;
+        }
+            
+        case LINK_CONNECTED:
+            if (!wifiLinkUp()) {
+                logPrintf("WiFi link lost, reconnecting\n");
+                trace(TRACE_WIFI_LINK, 0);
+                wifiConnected = false;
+                ntp.state = NTP_IDLE;
+                lanTimeStop();
+                wifiManager.state = LINK_BACKOFF;
+                wifiManager.stateSince = now;
+                wifiManager.retryDelay = WIFI_RETRY_MIN;
+            }
+            break;
+            
+        case LINK_BACKOFF:
+            if (now - wifiManager.stateSince > wifiManager.retryDelay) {
+                wifiManager.retryDelay = min(wifiManager.retryDelay * 2, (unsigned long)WIFI_RETRY_MAX);
+                connectToWiFi();
+            }
+            break;
+    }
+}
+
+void initializeNTPClient() {
+    ntpUDP.stop();
+    ntpUDP.begin(NTP_LOCAL_PORT);
+    
+    ntp.state = NTP_IDLE;
+    ntp.retryDelay = NTP_RETRY_MIN;
+}
+
+void cleanupWiFi() {
+    ntpUDP.stop();
+    ntp.state = NTP_IDLE;
+    lanTimeStop();
+    WiFi.disconnect(true);
+    WiFi.softAPdisconnect(true);
+    WiFi.mode(WIFI_OFF);
+    
+    wifiConnected = false;
+    wifiManager.state = LINK_IDLE;
+}
+
+// ==================== WIFI SCAN ====================
+#define SCAN_STATUS_RUNNING -1         // scanComplete() while in progress
+
+void startWiFiScan() {
+    if (scanCache.scanning) return;
+    WiFi.scanNetworks(true);
+    scanCache.scanning = true;
+    scanCache.startedAt = millis();
+}
+
+// Copies finished scan results into the cache, deduplicated and sorted
+void collectWiFiScan() {
+    int n = WiFi.scanComplete();
+    scanCache.scanning = false;
+    scanCache.finishedAt = millis();
+    if (n < 0) return;
+    
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        const char* ssid = WiFi.SSID(i);
+        int32_t rssi = WiFi.RSSI(i);
+        if (ssid == nullptr || ssid[0] == '\0') continue;
+        
+        int existing = -1;
+        for (int j = 0; j < count; j++) {
+            if (strcmp(scanCache.results[j].ssid, ssid) == 0) {
+                existing = j;
+                break;
+            }
+        }
+        if (existing >= 0) {
+            if (rssi <= scanCache.results[existing].rssi) continue;
+            // Stronger access point for a known SSID: take it out and re-insert
+            for (int j = existing; j < count - 1; j++) scanCache.results[j] = scanCache.results[j + 1];
+            count--;
+        }
+        
+        // Insertion sort by RSSI, dropping the weakest when full
+        int pos = count;
+        while (pos > 0 && scanCache.results[pos - 1].rssi < rssi) pos--;
+        if (pos >= SCAN_MAX_RESULTS) continue;
+        int last = min(count, SCAN_MAX_RESULTS - 1);
+        for (int j = last; j > pos; j--) scanCache.results[j] = scanCache.results[j - 1];
+        strlcpy(scanCache.results[pos].ssid, ssid, sizeof(scanCache.results[pos].ssid));
+        scanCache.results[pos].rssi = rssi;
+        if (count < SCAN_MAX_RESULTS) count++;
+    }
+    
+    scanCache.count = count;
+    scanCache.valid = true;
+    scanCache.completedAt = millis();
+}
+
+void handleWiFiScan() {
+    if (scanCache.scanning) {
+        if (WiFi.scanComplete() != SCAN_STATUS_RUNNING || millis() - scanCache.startedAt > WIFI_TIMEOUT) {
+            collectWiFiScan();
+        }
+    } else if (millis() - scanCache.finishedAt > SCAN_REFRESH_INTERVAL) {
+        startWiFiScan();
+    }
+}
+
+// ==================== DISPLAY FUNCTIONS ====================
+FrameMask buildTimeFrame(int hour, int minute) {
+    return faceFrame(*clockFace, hour, minute);
+}
+
+CRGB framePixel(const Frame& frame, int index) {
+    if (!((frame.mask >> index) & 1)) return CRGB::Black;
+    return ((clockFace->alwaysOn >> index) & 1) ? frame.alwaysOnColor : frame.color;
+}
+
+void renderFrame(const Frame& frame) {
+    int count = clockFace->numLeds;
+    for (int i = 0; i < count; i++) {
+        leds[i] = framePixel(frame, i);
+    }
+}
+
+// Core 1 only
+void showFrame(const Frame& frame) {
+    if (lastPushedFrameValid && frame == lastPushedFrame) {
+        framesSkipped++;
+        return;
+    }
+    
+    bool picture = !lastPushedFrameValid || frame.mask != lastPushedFrame.mask ||
+                   frame.color != lastPushedFrame.color || frame.alwaysOnColor != lastPushedFrame.alwaysOnColor;
+    
+    if (transition.active && !picture) {
+        // Brightness step while animating: retarget, don't restart
+        transition.to.brightness = frame.brightness;
+    } else if (picture && lastPushedFrameValid && frame.transition != TRANSITION_NONE && frame.transitionMs > 0) {
+        startTransition(lastPushedFrame, frame);
+    } else {
+        transition.active = false;
+        renderFrame(frame);
+        ws2812Show(leds, powerLimit(frameLoad(frame), frame.brightness));
+    }
+    trace(TRACE_FRAME_SHOWN, transition.active ? frame.transition : TRANSITION_NONE);
+    
+    lastPushedFrame = frame;
+    lastPushedFrameValid = true;
+    framesPushed++;
+}
+
+// Core 0 side: hand the frame to the renderer on core 1
+void publishFrame(const Frame& frame) {
+    frameMailbox.publish(frame);
+    trace(TRACE_FRAME_PUBLISHED);
+}
+
+// Core 1 only: call after writing leds[] directly so the next frame is
+// always pushed
+void invalidateFrame() {
+    lastPushedFrameValid = false;
+}
+
+// Core 0: the frame goes up when its showAtUs comes, or is dropped if 0
+void scheduleFrame(const Frame& frame) {
+    nextFlipUs = frame.showAtUs;
+    scheduleMailbox.publish(frame);
+}
+
+Frame timeFrame(const datetime_t& time) {
+    // HET IS shows orange while the time is only a restored estimate
+    CRGB alwaysOn = wallClock.synced ? CRGB(CRGB::Yellow) : CRGB(CRGB::OrangeRed);
+    return {buildTimeFrame(time.hour, time.min), CRGB::White, alwaysOn, ambientBrightness,
+            config.transitionStyle, config.transitionMs, 0};
+}
+
+void displayTime() {
+    publishFrame(timeFrame(currentTime));
+}
+
+// ==================== WEB INTERFACE ====================
+// Writes a response through a fixed buffer as HTTP chunks. Static text is
+// copied straight from flash and config values are printed in place, so no
+// page is ever assembled in a String.
+class ChunkedResponse : public Print {
+public:
+    ChunkedResponse(int code, const char* contentType) {
+        server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        server.send(code, contentType, "");
+    }
+    
+    ~ChunkedResponse() {
+        end();
+    }
+    
+    size_t write(uint8_t c) override {
+        if (used == sizeof(buffer)) flush();
+        buffer[used++] = c;
+        return 1;
+    }
+    
+    size_t write(const uint8_t* data, size_t length) override {
+        size_t remaining = length;
+        while (remaining > 0) {
+            if (used == sizeof(buffer)) flush();
+            size_t n = min(remaining, sizeof(buffer) - used);
+            memcpy(buffer + used, data, n);
+            used += n;
+            data += n;
+            remaining -= n;
+        }
+        return length;
+    }
+    
+    void flush() override {
+        if (used == 0) return;
+        server.sendContent(buffer, used);
+        used = 0;
+    }
+    
+    // For text inside attribute values and element content
+    void printEscaped(const char* text) {
+        for (; *text; text++) {
+            switch (*text) {
+                case '&': print(F("&amp;")); break;
+                case '<': print(F("&lt;")); break;
+                case '>': print(F("&gt;")); break;
+                case '\'': print(F("&#39;")); break;
+                case '"': print(F("&quot;")); break;
+                default: write((uint8_t)*text); break;
+            }
+        }
+    }
+    
+    void end() {
+        if (ended) return;
+        flush();
+        server.sendContent("");  // Terminating chunk
+        ended = true;
+    }
+    
+private:
+    char buffer[HTTP_CHUNK_SIZE];
+    size_t used = 0;
+    bool ended = false;
+};
+
+// const data stays in flash (XIP) on the RP2040
+static const char PAGE_STYLE[] =
+    "<style>*{box-sizing:border-box}body{font:14px Arial;margin:20px;background:#f0f0f0}"
+    ".c{max-width:600px;margin:0 auto;background:#fff;padding:20px;border-radius:8px}"
+    "h1{color:#333;text-align:center;margin:0 0 20px}"
+    ".g{margin:15px 0}label{display:block;margin-bottom:5px;font-weight:bold}"
+    "input,select{width:100%;padding:8px;border:1px solid #ddd;border-radius:4px}"
+    "button{background:#4CAF50;color:#fff;padding:10px 20px;border:none;border-radius:4px;cursor:pointer;margin:5px}"
+    "button:hover{background:#45a049}.danger{background:#f44336}.warning{background:#ff9800}"
+    ".wifi{max-height:150px;overflow-y:auto;border:1px solid #ddd;padding:10px}"
+    ".wifi div{cursor:pointer;padding:5px;border-bottom:1px solid #eee}"
+    "</style>";
+
+void sendPageHeader(ChunkedResponse& out, const __FlashStringHelper* title) {
+    out.print(F("<!DOCTYPE html><html><head><title>"));
+    out.print(title);
+    out.print(F("</title><meta name='viewport' content='width=device-width,initial-scale=1'>"));
+    // Versioned with the ETag, so a new filesystem image gets a new URL
+    const WebAsset& css = webAssets[WEB_ASSET_CSS];
+    if (css.present && clientAcceptsGzip()) {
+        out.print(F("<link rel='stylesheet' href='/app.css?v="));
+        out.write((const uint8_t*)css.etag + 1, sizeof(css.etag) - 3);   // Without the quotes
+        out.print(F("'>"));
+    } else {
+        out.print(PAGE_STYLE);
+    }
+    out.print(F("</head><body><div class='c'>"));
+}
+
+void sendPageFooter(ChunkedResponse& out, const __FlashStringHelper* script) {
+    out.print(F("</div>"));
+    if (script != nullptr) {
+        out.print(F("<script>"));
+        out.print(script);
+        out.print(F("</script>"));
+    }
+    out.print(F("</body></html>"));
+    out.end();
+}
+
+// Built-in setup page, for when there is no packed copy in LittleFS or
+// the browser does not take gzip
+void sendSetupPage() {
+    ChunkedResponse out(200, "text/html");
+    sendPageHeader(out, F("Word Clock Setup"));
+    
+    out.print(F("<h1>Word Clock Setup</h1>"));
+    out.print(F("<button onclick='scanWiFi()'>Scan WiFi Networks</button>"));
+    out.print(F("<div id='wifi' class='wifi' style='display:none'></div>"));
+    
+    out.print(F("<form action='/save' method='post'>"));
+    out.print(F("<div class='g'><label>WiFi Network:</label><input name='ssid' value='"));
+    out.printEscaped(config.ssid);
+    out.print(F("' required></div>"));
+    
+    // Never sent back out; left empty it stays as it is
+    out.print(F("<div class='g'><label>WiFi Password:</label><input type='password' name='password' placeholder='"));
+    out.print(config.password[0] ? F("unchanged") : F("none"));
+    out.print(F("'></div>"));
+    
+    out.print(F("<div class='g'><label>Timezone (POSIX TZ rule):</label><input name='timezone' list='tz' value='"));
+    out.printEscaped(config.timezone);
+    out.print(F("' required><datalist id='tz'>"));
+    out.print(F("<option value='CET-1CEST,M3.5.0,M10.5.0/3'>Netherlands</option>"));
+    out.print(F("<option value='GMT0BST,M3.5.0/1,M10.5.0'>London</option>"));
+    out.print(F("<option value='WET0WEST,M3.5.0/1,M10.5.0'>Lisbon</option>"));
+    out.print(F("<option value='EET-2EEST,M3.5.0/3,M10.5.0/4'>Helsinki</option>"));
+    out.print(F("<option value='EST5EDT,M3.2.0,M11.1.0'>New York</option>"));
+    out.print(F("<option value='UTC0'>UTC</option>"));
+    out.print(F("</datalist></div>"));
+    
+    out.print(F("<div class='g'><label>Transition:</label><select name='transition'>"));
+    for (int i = 0; i < TRANSITION_STYLE_COUNT; i++) {
+        out.print(F("<option value='"));
+        out.print(i);
+        out.print('\'');
+        if (config.transitionStyle == i) out.print(F(" selected"));
+        out.print('>');
+        out.print(TRANSITION_NAMES[i]);
+        out.print(F("</option>"));
+    }
+    out.print(F("</select></div>"));
+    
+    out.print(F("<div class='g'><label>Transition time (ms):</label><input type='number' name='transition_ms' min='0' max='5000' value='"));
+    out.print(config.transitionMs);
+    out.print(F("'></div>"));
+    
+    out.print(F("<div class='g'><label>Maximum brightness (10-255):</label><input type='number' name='brightness' min='10' max='255' value='"));
+    out.print(config.brightness);
+    out.print(F("'></div>"));
+    
+    out.print(F("<div class='g'><label><input type='checkbox' name='lan_time' style='width:auto'"));
+    if (config.lanTime) out.print(F(" checked"));
+    out.print(F("> Share time with other clocks on the network</label></div>"));
+    
+    out.print(F("<button type='submit'>Save</button></form>"));
+    
+    out.print(F("<form action='/restart' method='post'><button type='submit' class='warning'>Restart</button></form>"));
+    out.print(F("<form action='/reset' method='post'><button type='submit' class='danger'>Factory Reset</button></form>"));
+    
+    sendPageFooter(out, F("function scanWiFi(){fetch('/scan').then(r=>r.text()).then(d=>{document.getElementById('wifi').innerHTML=d;document.getElementById('wifi').style.display='block'})}"
+                          "function sel(s){document.querySelector('[name=ssid]').value=s}"));
+}
+
+// The same routes serve the portal and, once connected, the station
+// interface; they are registered once
+void setupWebServer() {
+    static bool registered = false;
+    if (registered) return;
+    registered = true;
+    
+    const char* headers[] = {"If-None-Match", "Accept-Encoding"};
+    server.collectHeaders(headers, 2);
+    
+    onRoute("/", HTTP_GET, []() {
+        if (!serveWebAsset(WEB_ASSET_INDEX)) sendSetupPage();
+    });
+    onRoute("/app.css", HTTP_GET, []() {
+        if (!serveWebAsset(WEB_ASSET_CSS)) server.send(404);
+    });
+    onRoute("/app.js", HTTP_GET, []() {
+        if (!serveWebAsset(WEB_ASSET_JS)) server.send(404);
+    });
+    
+    // Answers from the background scan cache, never scans inline
+    onRoute("/scan", HTTP_GET, []() {
+        ChunkedResponse out(200, "text/html");
+        
+        for (int i = 0; i < min(scanCache.count, 10); i++) {
+            const char* ssid = scanCache.results[i].ssid;
+            // The name stays out of the script; the browser decodes the attribute
+            out.print(F("<div onclick='sel(this.dataset.ssid)' data-ssid=\""));
+            out.printEscaped(ssid);
+            out.print(F("\">"));
+            out.printEscaped(ssid);
+            out.print(F(" ("));
+            out.print(scanCache.results[i].rssi);
+            out.print(F("dBm)</div>"));
+        }
+        
+        if (scanCache.valid) {
+            out.print(F("<small data-scan-age='"));
+            out.print((millis() - scanCache.completedAt) / 1000);
+            out.print(F("'>Scan age: "));
+            out.print((millis() - scanCache.completedAt) / 1000);
+            out.print(F(" s</small>"));
+        } else {
+            out.print(F("<small data-scan-age='-1'>Scanning...</small>"));
+        }
+        out.end();
+        
+        if (!scanCache.scanning && millis() - scanCache.finishedAt > SCAN_REFRESH_INTERVAL / 2) {
+            startWiFiScan();
+        }
+    });
+    
+    onRoute("/save", HTTP_POST, []() {
+        if (!webAuthorized()) return;
+        
+        Config next = config;
+        strlcpy(next.ssid, server.arg("ssid").c_str(), sizeof(next.ssid));
+        // An empty password keeps the stored one for the same network
+        if (server.arg("password").length() > 0 || strcmp(next.ssid, config.ssid) != 0) {
+            strlcpy(next.password, server.arg("password").c_str(), sizeof(next.password));
+        }
+        // Same check as PUT /api/config: a bad rule is refused, not ignored
+        if (server.hasArg("timezone")) {
+            const String& timezone = server.arg("timezone");
+            TzRule rule;
+            if (timezone.length() >= sizeof(next.timezone) || !tzParse(timezone.c_str(), rule)) {
+                ChunkedResponse out(400, "text/html");
+                sendPageHeader(out, F("Not saved"));
+                out.print(F("<h1>Not Saved</h1><p>Invalid timezone: "));
+                out.printEscaped(timezone.c_str());
+                out.print(F("</p><p><a href='/'>Back</a></p>"));
+                sendPageFooter(out);
+                return;
+            }
+            strlcpy(next.timezone, timezone.c_str(), sizeof(next.timezone));
+        }
+        next.brightness = constrain(server.arg("brightness").toInt(), 10, 255);
+        next.transitionStyle = constrain(server.arg("transition").toInt(), 0, TRANSITION_STYLE_COUNT - 1);
+        next.transitionMs = constrain(server.arg("transition_ms").toInt(), 0, TRANSITION_MAX_MS);
+        next.lanTime = server.hasArg("lan_time");
+        
+        uint8_t changes = applyConfig(next);
+        
+        {
+            ChunkedResponse out(200, "text/html");
+            sendPageHeader(out, F("Saved"));
+            out.print(F("<h1>Settings Saved!</h1>"));
+            if ((configMode && config.ssid[0]) || (changes & CONFIG_CHANGE_WIFI)) {
+                out.print(F("<p>Joining "));
+                out.printEscaped(config.ssid);
+                out.print(F(", find the clock there at http://" MDNS_HOSTNAME ".local</p>"));
+            } else {
+                out.print(F("<p>Applied.</p><p><a href='/'>Back</a></p>"));
+            }
+            sendPageFooter(out);
+        }
+        
+        // The portal has done its job once there is a network to join
+        if (configMode && config.ssid[0]) {
+            configManager.leavePortalPending = true;
+            taskKick(TASK_CONFIG);
+        }
+    });
+    
+    onRoute("/status", HTTP_GET, []() {
+        ChunkedResponse out(200, "text/html");
+        sendPageHeader(out, F("Status"));
+        
+        out.print(F("<h1>Status</h1>"));
+        out.print(F("<div style='margin:10px 0;padding:10px;background:#f9f9f9'>WiFi: "));
+        out.print(wifiConnected ? F("Connected") : F("Disconnected"));
+        out.print(F("</div>"));
+        out.print(F("<div style='margin:10px 0;padding:10px;background:#f9f9f9'>Time: "));
+        getCurrentTime();
+        out.print(currentTime.hour);
+        out.print(':');
+        if (currentTime.min < 10) out.print('0');
+        out.print(currentTime.min);
+        if (!wallClock.synced) out.print(F(" (estimated)"));
+        out.print(F("</div>"));
+        out.print(F("<div style='margin:10px 0;padding:10px;background:#f9f9f9'>NTP: offset "));
+        out.print(ntp.lastOffsetUs / 1000);
+        out.print(F(" ms, delay "));
+        out.print(ntp.lastDelayUs / 1000);
+        out.print(F(" ms, drift "));
+        out.print(wallClock.driftPpb);
+        out.print(F(" ppb, interval "));
+        out.print(ntp.interval / 60000);
+        out.print(F(" min</div>"));
+        out.print(F("<div style='margin:10px 0;padding:10px;background:#f9f9f9'>Frames: "));
+        out.print(framesPushed);
+        out.print(F(" pushed, "));
+        out.print(framesSkipped);
+        out.print(F(" skipped</div>"));
+        out.print(F("<div style='margin:10px 0;padding:10px;background:#f9f9f9'>Face: "));
+        out.printEscaped(clockFace->name);
+        out.print(F("</div>"));
+        out.print(F("<div style='margin:10px 0;padding:10px;background:#f9f9f9'>Transitions: "));
+        out.print(transitionFrames);
+        out.print(F(" frames, "));
+        out.print(transitionMissedDeadlines);
+        out.print(F(" missed deadlines</div>"));
+        
+        sendPageFooter(out);
+    });
+    
+    onRoute("/reset", HTTP_POST, []() {
+        if (!webAuthorized()) return;
+        resetConfiguration();
+        {
+            ChunkedResponse out(200, "text/html");
+            sendPageHeader(out, F("Reset"));
+            out.print(F("<h1>Factory Reset Complete</h1><p>Restarting...</p>"));
+            sendPageFooter(out);
+        }
+        requestRestart();
+    });
+    
+    onRoute("/restart", HTTP_POST, []() {
+        if (!webAuthorized()) return;
+        {
+            ChunkedResponse out(200, "text/html");
+            sendPageHeader(out, F("Restart"));
+            out.print(F("<h1>Restarting...</h1>"));
+            sendPageFooter(out);
+        }
+        requestRestart();
+    });
+    
+    setupApiRoutes();
+    setupMetricsRoutes();
+    setupOtaRoutes();
+    
+    server.onNotFound([]() {
+        server.sendHeader("Location", "/");
+        server.send(302);
+    });
+}
+
+// ==================== WEB ASSETS ====================
+// The setup page, its stylesheet and script are static and stored
+// gzipped in LittleFS; the settings and status come from the JSON API.
+// The ETag is the CRC of the stored file, so a browser that has a copy
+// gets a 304 instead of the body. The page references the stylesheet and
+// script with a content hash (?v=), and only such versioned requests are
+// cached without revalidation; a bare URL is revalidated every time.
+
+// After layoutBegin() has mounted LittleFS
+void webAssetsBegin() {
+    uint8_t buffer[256];
+    for (WebAsset& asset : webAssets) {
+        File file = LittleFS.open(asset.path, "r");
+        asset.present = (bool)file;
+        if (!file) continue;
+        
+        uint32_t crc = 0;
+        int n;
+        while ((n = file.read(buffer, sizeof(buffer))) > 0) crc = crc32Update(crc, buffer, n);
+        snprintf(asset.etag, sizeof(asset.etag), "\"%08lx\"", (unsigned long)crc);
+        logPrintf("Web asset %s: %u bytes, ETag %s\n", asset.path, (unsigned)file.size(), asset.etag);
+        file.close();
+    }
+}
+
+bool clientAcceptsGzip() {
+    return server.header("Accept-Encoding").indexOf("gzip") >= 0;
+}
+
+// False when the caller has to answer itself
+bool serveWebAsset(int id) {
+    const WebAsset& asset = webAssets[id];
+    if (!asset.present || !clientAcceptsGzip()) return false;
+    
+    server.sendHeader("ETag", asset.etag);
+    server.sendHeader("Cache-Control", server.hasArg("v") ? asset.cacheControl : "no-cache");
+    server.sendHeader("Vary", "Accept-Encoding");
+    if (server.header("If-None-Match") == asset.etag) {
+        server.send(304);
+        return true;
+    }
+    
+    File file = LittleFS.open(asset.path, "r");
+    if (!file) return false;
+    server.sendHeader("Content-Encoding", "gzip");
+    server.setContentLength(file.size());
+    server.send(200, asset.contentType, "");
+    
+    char buffer[HTTP_CHUNK_SIZE];
+    int n;
+    while ((n = file.read((uint8_t*)buffer, sizeof(buffer))) > 0) server.sendContent(buffer, n);
+    file.close();
+    return true;
+}
+
+// ==================== JSON API ====================
+// Documents live on the stack with a fixed pool and are serialised
+// straight into a ChunkedResponse. Keys and fixed strings are stored as
+// pointers, so building a response never touches the heap.
+void sendJson(int code, const JsonDocument& doc) {
+    ChunkedResponse out(code, "application/json");
+    serializeJson(doc, out);
+}
+
+void sendJsonError(int code, const char* message) {
+    StaticJsonDocument<64> doc;
+    doc["error"] = message;
+    sendJson(code, doc);
+}
+
+void apiStatus() {
+    StaticJsonDocument<API_STATUS_CAPACITY> doc;
+    
+    char localTime[20] = "";
+    if (wallClock.valid) {
+        datetime_t now;
+        clockLocalTime(now);
+        snprintf(localTime, sizeof(localTime), "%04d-%02d-%02dT%02d:%02d:%02d",
+                 now.year, now.month, now.day, now.hour, now.min, now.sec);
+        doc["time"] = localTime;
+        doc["utc"] = clockNow();
+    } else {
+        doc["time"] = nullptr;
+        doc["utc"] = nullptr;
+    }
+    doc["synced"] = wallClock.synced;
+    doc["offset_ms"] = ntp.lastOffsetUs / 1000.0f;
+    doc["delay_ms"] = ntp.lastDelayUs / 1000.0f;
+    doc["drift_ppb"] = wallClock.driftPpb;
+    doc["ntp_interval_s"] = ntp.interval / 1000;
+    doc["brightness"] = ambientBrightness;
+    doc["ambient"] = ambientLightLevel;
+    doc["wifi"] = wifiConnected;
+    if (wifiConnected) {
+        doc["rssi"] = WiFi.RSSI();
+    } else {
+        doc["rssi"] = nullptr;
+    }
+    doc["reconnects"] = wifiManager.reconnects;
+    doc["lan_role"] = LAN_ROLE_NAMES[lan.role];
+    doc["uptime_s"] = (uint32_t)(time_us_64() / 1000000);
+    doc["face"] = (const char*)clockFace->name;
+    doc["frames_pushed"] = framesPushed;
+    doc["frames_skipped"] = framesSkipped;
+    doc["current_ma"] = metrics.powerEstimateMa;
+    
+    sendJson(200, doc);
+}
+
+void apiConfigGet() {
+    StaticJsonDocument<API_CONFIG_CAPACITY> doc;
+    
+    // The password is write-only
+    doc["ssid"] = (const char*)config.ssid;
+    doc["ntp_server"] = (const char*)config.ntpServer;
+    doc["timezone"] = (const char*)config.timezone;
+    doc["brightness"] = config.brightness;
+    doc["transition"] = TRANSITION_NAMES[config.transitionStyle];
+    doc["transition_ms"] = config.transitionMs;
+    doc["configured"] = config.configured;
+    doc["lan_time"] = config.lanTime;
+    JsonArray transitions = doc.createNestedArray("transitions");
+    for (int i = 0; i < TRANSITION_STYLE_COUNT; i++) transitions.add(TRANSITION_NAMES[i]);
+    
+    sendJson(200, doc);
+}
+
+int transitionFromJson(JsonVariantConst value) {
+    if (value.is<int>()) {
+        int style = value.as<int>();
+        return (style >= 0 && style < TRANSITION_STYLE_COUNT) ? style : -1;
+    }
+    const char* name = value.as<const char*>();
+    if (name == nullptr) return -1;
+    for (int i = 0; i < TRANSITION_STYLE_COUNT; i++) {
+        if (strcasecmp(name, TRANSITION_NAMES[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// Accepts any subset of the GET fields plus "password"; everything is
+// validated before anything is applied
+void apiConfigPut() {
+    if (!webAuthorized()) return;
+    
+    StaticJsonDocument<API_CONFIG_CAPACITY> doc;
+    const String& body = server.arg("plain");
+    if (deserializeJson(doc, body.c_str(), body.length()) != DeserializationError::Ok || !doc.is<JsonObject>()) {
+        sendJsonError(400, "invalid JSON");
+        return;
+    }
+    
+    const char* ssid = doc["ssid"] | (const char*)config.ssid;
+    const char* password = doc["password"] | (const char*)config.password;
+    const char* ntpServer = doc["ntp_server"] | (const char*)config.ntpServer;
+    const char* timezone = doc["timezone"] | (const char*)config.timezone;
+    int brightness = doc["brightness"] | config.brightness;
+    int transition = doc.containsKey("transition") ? transitionFromJson(doc["transition"]) : config.transitionStyle;
+    int transitionMs = doc["transition_ms"] | (int)config.transitionMs;
+    bool lanTime = doc["lan_time"] | config.lanTime;
+    
+    TzRule rule;
+    if (strlen(ssid) >= sizeof(config.ssid) || strlen(password) >= sizeof(config.password) ||
+        strlen(ntpServer) >= sizeof(config.ntpServer) || strlen(timezone) >= sizeof(config.timezone)) {
+        sendJsonError(400, "value too long");
+        return;
+    }
+    if (!tzParse(timezone, rule)) {
+        sendJsonError(400, "invalid timezone");
+        return;
+    }
+    if (brightness < 10 || brightness > 255 || transition < 0 || transitionMs < 0 || transitionMs > TRANSITION_MAX_MS) {
+        sendJsonError(400, "value out of range");
+        return;
+    }
+    
+    Config next = config;
+    strlcpy(next.ssid, ssid, sizeof(next.ssid));
+    strlcpy(next.password, password, sizeof(next.password));
+    strlcpy(next.ntpServer, ntpServer, sizeof(next.ntpServer));
+    strlcpy(next.timezone, timezone, sizeof(next.timezone));
+    next.brightness = brightness;
+    next.transitionStyle = transition;
+    next.transitionMs = transitionMs;
+    next.lanTime = lanTime;
+    uint8_t changes = applyConfig(next);
+    bool leavePortal = configMode && config.ssid[0];
+    
+    StaticJsonDocument<64> reply;
+    reply["saved"] = true;
+    reply["reconnecting"] = leavePortal || (changes & CONFIG_CHANGE_WIFI) != 0;
+    sendJson(200, reply);
+    
+    if (leavePortal) {
+        configManager.leavePortalPending = true;
+        taskKick(TASK_CONFIG);
+    }
+}
+
+// Same cache as /scan; a stale one starts a new background scan
+void apiScan() {
+    StaticJsonDocument<API_SCAN_CAPACITY> doc;
+    JsonArray networks = doc.createNestedArray("networks");
+    for (int i = 0; i < min(scanCache.count, API_SCAN_LIMIT); i++) {
+        JsonObject network = networks.createNestedObject();
+        network["ssid"] = (const char*)scanCache.results[i].ssid;
+        network["rssi"] = scanCache.results[i].rssi;
+    }
+    doc["age_s"] = scanCache.valid ? (long)((millis() - scanCache.completedAt) / 1000) : -1L;
+    sendJson(200, doc);
+    
+    if (!scanCache.scanning && millis() - scanCache.finishedAt > SCAN_REFRESH_INTERVAL / 2) {
+        startWiFiScan();
+    }
+}
+
+void setupApiRoutes() {
+    onRoute("/api/status", HTTP_GET, apiStatus);
+    onRoute("/api/config", HTTP_GET, apiConfigGet);
+    onRoute("/api/config", HTTP_PUT, apiConfigPut);
+    onRoute("/api/scan", HTTP_GET, apiScan);
+}
+
+// ==================== METRICS ====================
+// Timestamps come from the 1 MHz system timer: the M0+ has no DWT cycle
+// counter, and a timer read is a single bus access.
+void metricsObserve(Histogram& histogram, uint32_t us) {
+    // Bucket i holds values up to 16 << 2i, found from the bit length
+    int bucket = us <= 16 ? 0 : (32 - __builtin_clz(us - 1) - 3) / 2;
+    histogram.buckets[min(bucket, METRICS_BUCKETS)]++;
+    histogram.count++;
+    histogram.sumUs += us;
+}
+
+// newlib does not report fragmentation, so find the biggest malloc()
+// that still succeeds
+size_t largestFreeBlock() {
+    size_t low = 0;
+    size_t high = rp2040.getFreeHeap();
+    while (low < high) {
+        size_t size = (low + high + 1) / 2;
+        void* block = malloc(size);
+        if (block) {
+            free(block);
+            low = size;
+        } else {
+            high = size - 1;
+        }
     }
-    else if (minute == 5) {
-        lightUpWord(PRECIES_LEDS, 7);
-        leds[VIJF_MIN_LED] = CRGB::White;
-        lightUpWord(OVER_LEDS, 4);
+    return low;
+}
+
+void onRoute(const char* uri, HTTPMethod method, WebServer::THandlerFunction handler,
+             WebServer::THandlerFunction upload) {
+    if (metrics.routeCount == METRICS_ROUTES_MAX) {
+        if (upload) {
+            server.on(uri, method, handler, upload);
+        } else {
+            server.on(uri, method, handler);
+        }
+        return;
     }
-    else if (minute >= 6 && minute <= 7) {
-        lightUpWord(RUIM_LEDS, 4);
-        leds[VIJF_MIN_LED] = CRGB::White;
-        lightUpWord(OVER_LEDS, 4);
+    RouteMetric* route = &metrics.routes[metrics.routeCount++];
+    route->uri = uri;
+    route->method = method == HTTP_GET ? "GET" : method == HTTP_POST ? "POST" : method == HTTP_PUT ? "PUT" : "OTHER";
+    auto timed = [route, handler]() {
+        uint32_t startedAt = time_us_32();
+        handler();
+        uint32_t elapsed = time_us_32() - startedAt;
+        metricsObserve(route->latency, elapsed);
+        trace(TRACE_HTTP_REQUEST, route - metrics.routes, elapsed);
+    };
+    if (upload) {
+        server.on(uri, method, timed, upload);
+    } else {
+        server.on(uri, method, timed);
     }
-    else if (minute >= 8 && minute <= 9) {
-        lightUpWord(BIJNA_LEDS, 4);
-        leds[TIEN_MIN_LED] = CRGB::White;
-        lightUpWord(OVER_LEDS, 4);
+}
+
+void printHistogram(Print& out, const char* name, const char* help, const Histogram& histogram,
+                    const char* labels = nullptr) {
+    if (help) {
+        out.printf("# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
     }
-    else if (minute == 10) {
-        lightUpWord(PRECIES_LEDS, 7);
-        leds[TIEN_MIN_LED] = CRGB::White;
-        lightUpWord(OVER_LEDS, 4);
+    const char* separator = labels ? "," : "";
+    if (!labels) labels = "";
+    
+    uint32_t cumulative = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        cumulative += histogram.buckets[i];
+        out.printf("%s_bucket{%s%sle=\"%.6f\"} %lu\n", name, labels, separator,
+                   (16UL << (2 * i)) / 1e6, (unsigned long)cumulative);
     }
-    else if (minute >= 11 && minute <= 12) {
-        lightUpWord(RUIM_LEDS, 4);
-        leds[TIEN_MIN_LED] = CRGB::White;
-        lightUpWord(OVER_LEDS, 4);
+    out.printf("%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, separator, (unsigned long)histogram.count);
+    out.printf("%s_sum{%s} %.6f\n", name, labels, histogram.sumUs / 1e6);
+    out.printf("%s_count{%s} %lu\n", name, labels, (unsigned long)histogram.count);
+}
+
+void printMetric(Print& out, const char* name, const char* type, const char* help, double value) {
+    out.printf("# HELP %s %s\n# TYPE %s %s\n%s %.9g\n", name, help, name, type, name, value);
+}
+
+// Prometheus text format, streamed through the chunked writer
+void sendMetrics() {
+    ChunkedResponse out(200, "text/plain; version=0.0.4");
+    
+    printHistogram(out, "wordclock_loop_seconds", "Busy time of one loop() pass", metrics.loopTime);
+    printHistogram(out, "wordclock_show_seconds", "Time to encode and start a frame", metrics.showTime);
+    printMetric(out, "wordclock_frames_shown_total", "counter", "Frames sent to the LEDs", metrics.framesShown);
+    printMetric(out, "wordclock_led_current_amperes", "gauge", "Estimated LED supply current of the last frame", metrics.powerEstimateMa / 1e3);
+    printMetric(out, "wordclock_power_limited_frames_total", "counter", "Frames dimmed to stay within the power budget", metrics.powerLimited);
+    printMetric(out, "wordclock_led_refreshes_total", "counter", "LED transfers including dither refreshes", metrics.refreshes);
+    
+    printHistogram(out, "wordclock_ntp_delay_seconds", "SNTP round trip per accepted reply", metrics.ntpDelay);
+    printHistogram(out, "wordclock_ntp_offset_seconds", "Absolute SNTP offset per accepted reply", metrics.ntpOffset);
+    printMetric(out, "wordclock_ntp_syncs_total", "counter", "Accepted SNTP replies", metrics.ntpSyncs);
+    printMetric(out, "wordclock_ntp_failures_total", "counter", "Failed SNTP attempts", metrics.ntpFailures);
+    printMetric(out, "wordclock_ntp_last_offset_seconds", "gauge", "Offset of the last accepted reply", ntp.lastOffsetUs / 1e6);
+    printMetric(out, "wordclock_lan_leader", "gauge", "1 while this clock leads LAN time", lan.role == LAN_LEADER);
+    printMetric(out, "wordclock_lan_beacons_sent_total", "counter", "LAN time beacons sent", lan.sent);
+    printMetric(out, "wordclock_lan_beacons_received_total", "counter", "LAN time beacons accepted", lan.received);
+    printMetric(out, "wordclock_lan_beacons_rejected_total", "counter", "LAN time beacons with a bad MAC, size or time", lan.rejected);
+    printMetric(out, "wordclock_clock_drift_ppb", "gauge", "Measured timer drift", wallClock.driftPpb);
+    printMetric(out, "wordclock_clock_synced", "gauge", "Time confirmed by NTP since boot", wallClock.synced);
+    
+    printMetric(out, "wordclock_wifi_reconnects_total", "counter", "Station reconnects after a lost link", wifiManager.reconnects);
+    printMetric(out, "wordclock_wifi_rssi_dbm", "gauge", "Station signal strength", wifiConnected ? WiFi.RSSI() : 0);
+    
+    out.print(F("# HELP wordclock_http_request_seconds Handler time per route\n"
+                "# TYPE wordclock_http_request_seconds histogram\n"));
+    for (int i = 0; i < metrics.routeCount; i++) {
+        char labels[64];
+        snprintf(labels, sizeof(labels), "route=\"%s\",method=\"%s\"", metrics.routes[i].uri, metrics.routes[i].method);
+        printHistogram(out, "wordclock_http_request_seconds", nullptr, metrics.routes[i].latency, labels);
     }
-    else if (minute >= 13 && minute <= 14) {
-        lightUpWord(BIJNA_LEDS, 4);
-        lightUpWord(KWART_LEDS, 5);
-        lightUpWord(OVER_LEDS, 4);
-    }
-    else if (minute == 15) {
-        lightUpWord(PRECIES_LEDS, 7);
-        lightUpWord(KWART_LEDS, 5);
-        lightUpWord(OVER_LEDS, 4);
-    }
-    else if (minute >= 16 && minute <= 17) {
-        lightUpWord(RUIM_LEDS, 4);
-        lightUpWord(KWART_LEDS, 5);
-        lightUpWord(OVER_LEDS, 4);
-    }
-    else if (minute >= 18 && minute <= 19) {
-        lightUpWord(BIJNA_LEDS, 4);
-        leds[TIEN_MIN_LED] = CRGB::White;
-        lightUpWord(VOOR_LEDS, 4);
-        lightUpWord(HALF_LEDS, 4);
-    }
-    else if (minute == 20) {
-        lightUpWord(PRECIES_LEDS, 7);
-        leds[TIEN_MIN_LED] = CRGB::White;
-        lightUpWord(VOOR_LEDS, 4);
-        lightUpWord(HALF_LEDS, 4);
-    }
-    else if (minute >= 21 && minute <= 22) {
-        lightUpWord(RUIM_LEDS, 4);
-        leds[TIEN_MIN_LED] = CRGB::White;
-        lightUpWord(VOOR_LEDS, 4);
-        lightUpWord(HALF_LEDS, 4);
-    }
-    else if (minute >= 23 && minute <= 24) {
-        lightUpWord(BIJNA_LEDS, 4);
-        leds[VIJF_MIN_LED] = CRGB::White;
-        lightUpWord(VOOR_LEDS, 4);
-        lightUpWord(HALF_LEDS, 4);
-    }
-    else if (minute == 25) {
-        lightUpWord(PRECIES_LEDS, 7);
-        leds[VIJF_MIN_LED] = CRGB::White;
-        lightUpWord(VOOR_LEDS, 4);
-        lightUpWord(HALF_LEDS, 4);
-    }
-    else if (minute >= 26 && minute <= 27) {
-        lightUpWord(RUIM_LEDS, 4);
-        leds[VIJF_MIN_LED] = CRGB::White;
-        lightUpWord(VOOR_LEDS, 4);
-        lightUpWord(HALF_LEDS, 4);
-    }
-    else if (minute >= 28 && minute <= 29) {
-        lightUpWord(BIJNA_LEDS, 4);
-        lightUpWord(HALF_LEDS, 4);
-    }
-    else if (minute == 30) {
-        lightUpWord(PRECIES_LEDS, 7);
-        lightUpWord(HALF_LEDS, 4);
-    }
-    else if (minute >= 31 && minute <= 32) {
-        lightUpWord(RUIM_LEDS, 4);
-        lightUpWord(HALF_LEDS, 4);
-    }
-    else if (minute >= 33 && minute <= 34) {
-        lightUpWord(BIJNA_LEDS, 4);
-        leds[VIJF_MIN_LED] = CRGB::White;
-        lightUpWord(OVER_LEDS, 4);
-        lightUpWord(HALF_LEDS, 4);
-    }
-    else if (minute == 35) {
-        lightUpWord(PRECIES_LEDS, 7);
-        leds[VIJF_MIN_LED] = CRGB::White;
-        lightUpWord(OVER_LEDS, 4);
-        lightUpWord(HALF_LEDS, 4);
-    }
-    else if (minute >= 36 && minute <= 37) {
-        lightUpWord(RUIM_LEDS, 4);
-        leds[VIJF_MIN_LED] = CRGB::White;
-        lightUpWord(OVER_LEDS, 4);
-        lightUpWord(HALF_LEDS, 4);
-    }
-    else if (minute >= 38 && minute <= 39) {
-        lightUpWord(BIJNA_LEDS, 4);
-        leds[TIEN_MIN_LED] = CRGB::White;
-        lightUpWord(OVER_LEDS, 4);
-        lightUpWord(HALF_LEDS, 4);
-    }
-    else if (minute == 40) {
-        lightUpWord(PRECIES_LEDS, 7);
-        leds[TIEN_MIN_LED] = CRGB::White;
-        lightUpWord(OVER_LEDS, 4);
-        lightUpWord(HALF_LEDS, 4);
-    }
-    else if (minute >= 41 && minute <= 42) {
-        lightUpWord(RUIM_LEDS, 4);
-        leds[TIEN_MIN_LED] = CRGB::White;
-        lightUpWord(OVER_LEDS, 4);
-        lightUpWord(HALF_LEDS, 4);
-    }
-    else if (minute >= 43 && minute <= 44) {
-        lightUpWord(BIJNA_LEDS, 4);
-        lightUpWord(KWART_LEDS, 5);
-        lightUpWord(VOOR_LEDS, 4);
-    }
-    else if (minute == 45) {
-        lightUpWord(PRECIES_LEDS, 7);
-        lightUpWord(KWART_LEDS, 5);
-        lightUpWord(VOOR_LEDS, 4);
-    }
-    else if (minute >= 46 && minute <= 47) {
-        lightUpWord(RUIM_LEDS, 4);
-        lightUpWord(KWART_LEDS, 5);
-        lightUpWord(VOOR_LEDS, 4);
-    }
-    else if (minute >= 48 && minute <= 49) {
-        lightUpWord(BIJNA_LEDS, 4);
-        leds[TIEN_MIN_LED] = CRGB::White;
-        lightUpWord(VOOR_LEDS, 4);
-    }
-    else if (minute == 50) {
-        lightUpWord(PRECIES_LEDS, 7);
-        leds[TIEN_MIN_LED] = CRGB::White;
-        lightUpWord(VOOR_LEDS, 4);
-    }
-    else if (minute >= 51 && minute <= 52) {
-        lightUpWord(RUIM_LEDS, 4);
-        leds[TIEN_MIN_LED] = CRGB::White;
-        lightUpWord(VOOR_LEDS, 4);
-    }
-    else if (minute >= 53 && minute <= 54) {
-        lightUpWord(BIJNA_LEDS, 4);
-        leds[VIJF_MIN_LED] = CRGB::White;
-        lightUpWord(VOOR_LEDS, 4);
-    }
-    else if (minute == 55) {
-        lightUpWord(PRECIES_LEDS, 7);
-        leds[VIJF_MIN_LED] = CRGB::White;
-        lightUpWord(VOOR_LEDS, 4);
-    }
-    else if (minute >= 56 && minute <= 57) {
-        lightUpWord(RUIM_LEDS, 4);
-        leds[VIJF_MIN_LED] = CRGB::White;
-        lightUpWord(VOOR_LEDS, 4);
-    }
-    else if (minute >= 58 && minute <= 59) {
-        lightUpWord(BIJNA_LEDS, 4);
-        // "Het is bijna [uur] uur"
-        for (int i = 0; i < 3; i++) {
-            leds[UUR_LEDS[i]] = CRGB::White;
-        }
+    
+    printTaskMetrics(out);
+    
+    printMetric(out, "wordclock_heap_free_bytes", "gauge", "Free heap", rp2040.getFreeHeap());
+    printMetric(out, "wordclock_heap_largest_free_bytes", "gauge", "Largest allocatable block", largestFreeBlock());
+    printMetric(out, "wordclock_flash_writes_total", "counter", "Journal records programmed", metrics.flashWrites);
+    printMetric(out, "wordclock_flash_erases_total", "counter", "Flash sectors erased", metrics.flashErases);
+    printMetric(out, "wordclock_trace_dropped_total", "counter", "Trace events lost to a full ring",
+                traceRings[0].dropped + traceRings[1].dropped);
+    printMetric(out, "wordclock_log_dropped_total", "counter", "Log lines lost to a full buffer", logRing.dropped);
+    printMetric(out, "wordclock_uptime_seconds", "counter", "Time since boot", time_us_64() / 1e6);
+}
+
+void setupMetricsRoutes() {
+    onRoute("/metrics", HTTP_GET, sendMetrics);
+}
+
+void webServerBegin() {
+    if (webServerRunning) return;
+    webServerRunning = true;
+    server.begin();
+}
+
+void mdnsBegin() {
+    static bool started = false;
+    if (started) {
+        MDNS.notifyAPChange();   // Re-announce after a reconnect
+        return;
     }
+    started = MDNS.begin(MDNS_HOSTNAME);
+    if (started) MDNS.addService("http", "tcp", WEB_PORT);
 }
 
-// ==================== WEB INTERFACE ====================
-String generateCompactHTML(const String& title, const String& body, const String& script) {
-    String html = F("<!DOCTYPE html><html><head><title>");
-    html += title;
-    html += F("</title><meta name='viewport' content='width=device-width,initial-scale=1'>");
-    html += F("<style>*{box-sizing:border-box}body{font:14px Arial;margin:20px;background:#f0f0f0}");
-    html += F(".c{max-width:600px;margin:0 auto;background:#fff;padding:20px;border-radius:8px}");
-    html += F("h1{color:#333;text-align:center;margin:0 0 20px}");
-    html += F(".g{margin:15px 0}label{display:block;margin-bottom:5px;font-weight:bold}");
-    html += F("input,select{width:100%;padding:8px;border:1px solid #ddd;border-radius:4px}");
-    html += F("button{background:#4CAF50;color:#fff;padding:10px 20px;border:none;border-radius:4px;cursor:pointer;margin:5px}");
-    html += F("button:hover{background:#45a049}.danger{background:#f44336}.warning{background:#ff9800}");
-    html += F(".wifi{max-height:150px;overflow-y:auto;border:1px solid #ddd;padding:10px}");
-    html += F(".wifi div{cursor:pointer;padding:5px;border-bottom:1px solid #eee}");
-    html += F("</style></head><body><div class='c'>");
-    html += body;
-    html += F("</div>");
-    if (script.length() > 0) {
-        html += F("<script>");
-        html += script;
-        html += F("</script>");
-    }
-    html += F("</body></html>");
-    return html;
+// Changes from the LAN need the WiFi password; the portal AP has its own
+bool webAuthorized() {
+    if (configMode || config.password[0] == '\0') return true;
+    if (server.authenticate(WEB_USER, config.password)) return true;
+    server.requestAuthentication();
+    return false;
 }
 
-void setupWebServer() {
-    server.on("/", HTTP_GET, []() {
-        String body = F("<h1>Word Clock Setup</h1>");
-        body += F("<button onclick='scanWiFi()'>Scan WiFi Networks</button>");
-        body += F("<div id='wifi' class='wifi' style='display:none'></div>");
-        
-        body += F("<form action='/save' method='post'>");
-        body += F("<div class='g'><label>WiFi Network:</label><input name='ssid' value='");
-        body += config.ssid;
-        body += F("' required></div>");
-        
-        body += F("<div class='g'><label>WiFi Password:</label><input type='password' name='password' value='");
-        body += config.password;
-        body += F("'></div>");
-        
-        body += F("<div class='g'><label>Timezone:</label><select name='timezone'>");
-        body += F("<option value='3600'");
-        if (config.timezoneOffset == 3600) body += F(" selected");
-        body += F(">Netherlands (UTC+1)</option>");
-        body += F("<option value='0'");
-        if (config.timezoneOffset == 0) body += F(" selected");
-        body += F(">London (UTC+0)</option>");
-        body += F("</select></div>");
-        
-        body += F("<div class='g'><label><input type='checkbox' name='daylight_saving' value='1'");
-        if (config.daylightSaving) body += F(" checked");
-        body += F("> Enable Daylight Saving Time</label></div>");
-        
-        body += F("<div class='g'><label>Brightness (10-255):</label><input type='number' name='brightness' min='10' max='255' value='");
-        body += config.brightness;
-        body += F("'></div>");
+// ==================== OTA UPDATE ====================
+// POST /update?size=<bytes>[&crc=<crc32 hex>][&md5=<hex>][&rollback=0]
+// with the raw .bin as a multipart file, e.g.
+//   curl -u admin:<wifi password> --retry 30 -F image=@firmware.bin \
+//     "http://<clock>/update?size=$(stat -c%s firmware.bin)"
+// The RP2040 runs from one fixed flash address, so the second slot is a
+// LittleFS file: chunks go straight from the network buffer into it and
+// the OTA bootloader copies it over the sketch on the next reboot.
+//
+// Rollback needs the running image and the new one in LittleFS at the
+// same time. The first request only starts copying the running image,
+// OTA_COPY_CHUNK per step from the scheduler, and is answered 503 with
+// Retry-After; uploads are accepted once the copy is complete. The new
+// image is restored if it does not stay up for OTA_CONFIRM_MS within
+// OTA_TRIAL_BOOTS boots; the watchdog is armed during the trial, so a
+// hang counts as a failed boot as well. When both images do not fit (the
+// default 1 MB filesystem only holds two small sketches) the upload is
+// refused with 507, unless rollback=0 accepts an update without one.
+//
+// Core 1 keeps the display going throughout; it only pauses while a
+// flash sector is written, with the LEDs holding the last frame. Data
+// arriving just before a minute flip is held in RAM until it has passed.
+struct OtaUpload {
+    bool active = false;
+    const char* error = nullptr;
+    int errorCode = 400;
+    size_t expected = 0;
+    size_t received = 0;
+    uint32_t crc = 0;
+};
+
+OtaUpload ota;
+bool otaTrial = false;
+
+enum OtaRollbackState {
+    OTA_ROLLBACK_NONE,
+    OTA_ROLLBACK_COPYING,
+    OTA_ROLLBACK_READY
+};
+
+// Copy of the running image, made by taskOta() before an upload
+struct OtaRollback {
+    OtaRollbackState state = OTA_ROLLBACK_NONE;
+    File file;
+    size_t copied = 0;
+};
+
+OtaRollback otaRollback;
+
+size_t otaRunningImageSize() {
+    return (uintptr_t)&__flash_binary_end - XIP_BASE;
+}
+
+size_t otaImageLimit() {
+    return (uintptr_t)&_FS_start - (JOURNAL_SECTORS + CLOCK_JOURNAL_SECTORS) * FLASH_SECTOR_SIZE - XIP_BASE;
+}
+
+// Flash writes stall core 1, so none start just before the flip or
+// while it is being shown
+bool otaNearFlip() {
+    int64_t untilFlip = (int64_t)(nextFlipUs - time_us_64());
+    return untilFlip > -2000 && untilFlip < OTA_FLIP_GUARD_US;
+}
+
+// Upload chunks arriving near a flip wait here instead of in the handler
+uint8_t otaHold[OTA_HOLD_BYTES];
+size_t otaHeld = 0;
+
+bool otaFlushHeld() {
+    size_t n = otaHeld;
+    otaHeld = 0;
+    return n == 0 || Update.write(otaHold, n) == n;
+}
+
+// Only a hold buffer that has run full writes through the guard window
+bool otaStage(uint8_t* data, size_t length) {
+    if (otaNearFlip() && otaHeld + length <= sizeof(otaHold)) {
+        memcpy(otaHold + otaHeld, data, length);
+        otaHeld += length;
+        return true;
+    }
+    return otaFlushHeld() && Update.write(data, length) == length;
+}
+
+void otaFail(const char* error, int code = 400) {
+    if (ota.error) return;
+    ota.error = error;
+    ota.errorCode = code;
+    trace(TRACE_OTA, 2, ota.received);
+    logPrintf("OTA failed: %s\n", error);
+}
+
+// Room for the rollback copy (unless there already is one) next to the
+// staged image, with a few sectors to spare for LittleFS itself
+bool otaRollbackFits(size_t incoming) {
+    FSInfo info;
+    LittleFS.info(info);
+    size_t needed = incoming + 4 * FLASH_SECTOR_SIZE;
+    if (otaRollback.state != OTA_ROLLBACK_READY) needed += otaRunningImageSize() - otaRollback.copied;
+    return info.usedBytes + needed <= info.totalBytes;
+}
+
+void otaRollbackStart() {
+    if (otaRollback.state != OTA_ROLLBACK_NONE) return;
+    LittleFS.remove(OTA_ROLLBACK_FILE);
+    otaRollback.file = LittleFS.open(OTA_ROLLBACK_FILE, "w");
+    if (!otaRollback.file) {
+        logPrintf("OTA: cannot create the rollback copy\n");
+        return;
+    }
+    otaRollback.state = OTA_ROLLBACK_COPYING;
+    otaRollback.copied = 0;
+    logPrintf("OTA: copying the running image (%u bytes) for rollback\n", (unsigned)otaRunningImageSize());
+    taskKick(TASK_OTA);
+}
+
+// One chunk per call, so no pass of the loop spends more than one
+// sector erase on it. Returns true while the copy is still going.
+bool otaRollbackStep() {
+    if (otaRollback.state != OTA_ROLLBACK_COPYING) return false;
+    
+    size_t imageSize = otaRunningImageSize();
+    size_t n = min((size_t)OTA_COPY_CHUNK, imageSize - otaRollback.copied);
+    
+    if (otaNearFlip()) return true;    // Next step, after the flip
+    
+    // XIP is off while LittleFS programs, so copy through RAM
+    uint8_t buffer[OTA_COPY_CHUNK];
+    memcpy(buffer, (const uint8_t*)XIP_BASE + otaRollback.copied, n);
+    if (otaRollback.file.write(buffer, n) != n) {
+        otaRollback.file.close();
+        LittleFS.remove(OTA_ROLLBACK_FILE);
+        otaRollback.state = OTA_ROLLBACK_NONE;
+        logPrintf("OTA: rollback copy failed\n");
+        return false;
+    }
+    
+    otaRollback.copied += n;
+    if (otaRollback.copied < imageSize) return true;
+    otaRollback.file.close();
+    otaRollback.state = OTA_ROLLBACK_READY;
+    logPrintf("OTA: rollback copy ready\n");
+    return false;
+}
+
+// A raw image has the vector table after the 256-byte boot2 stage
+bool otaImageLooksValid(const uint8_t* data, size_t length) {
+    if (length < 0x108) return true;   // Too short to tell, the CRC has to do
+    uint32_t stack, reset;
+    memcpy(&stack, data + 0x100, 4);
+    memcpy(&reset, data + 0x104, 4);
+    return stack > SRAM_BASE && stack <= SRAM_END && reset > XIP_BASE && reset < XIP_BASE + 0x1000000 && (reset & 1);
+}
+
+void otaUploadChunk() {
+    HTTPUpload& upload = server.upload();
+    
+    // The whole body arrives within one handleClient() call
+    rp2040.wdt_reset();
+    
+    if (upload.status == UPLOAD_FILE_START) {
+        ota = OtaUpload();
+        ota.active = true;
+        otaHeld = 0;
+        if (config.password[0] && !server.authenticate(WEB_USER, config.password)) {
+            otaFail("unauthorized", 401);
+            return;
+        }
+        ota.expected = server.arg("size").toInt();
+        if (ota.expected == 0) {
+            otaFail("size required");
+            return;
+        }
+        if (ota.expected > otaImageLimit()) {
+            otaFail("image would overlap the config journals");
+            return;
+        }
         
-        body += F("<button type='submit'>Save & Restart</button></form>");
+        if (server.arg("rollback") != "0") {
+            if (!otaRollbackFits(ota.expected)) {
+                otaFail("no room for a rollback copy, rollback=0 updates without one", 507);
+                return;
+            }
+            if (otaRollback.state != OTA_ROLLBACK_READY) {
+                otaRollbackStart();
+                if (otaRollback.state == OTA_ROLLBACK_COPYING) {
+                    otaFail("preparing the rollback copy, retry", 503);
+                } else {
+                    otaFail("cannot create the rollback copy", 500);
+                }
+                return;
+            }
+        }
         
-        body += F("<form action='/restart' method='post'><button type='submit' class='warning'>Restart</button></form>");
-        body += F("<form action='/reset' method='post'><button type='submit' class='danger'>Factory Reset</button></form>");
+        logPrintf("OTA: receiving %u bytes\n", (unsigned)ota.expected);
+        trace(TRACE_OTA, 0, ota.expected);
+        if (!Update.begin(ota.expected)) {
+            otaFail("not enough space to stage the image", 507);
+            return;
+        }
+        if (server.hasArg("md5") && !Update.setMD5(server.arg("md5").c_str())) {
+            otaFail("invalid md5");
+        }
+    } else if (upload.status == UPLOAD_FILE_WRITE) {
+        if (ota.error) return;
+        if (ota.received == 0 && !otaImageLooksValid(upload.buf, upload.currentSize)) {
+            otaFail("not an RP2040 image (raw .bin expected)");
+            return;
+        }
+        if (ota.received + upload.currentSize > ota.expected) {
+            otaFail("more data than size");
+            return;
+        }
         
-        String script = F("function scanWiFi(){fetch('/scan').then(r=>r.text()).then(d=>{document.getElementById('wifi').innerHTML=d;document.getElementById('wifi').style.display='block'})}");
-        script += F("function sel(s){document.querySelector('[name=ssid]').value=s}");
+        ota.crc = crc32Update(ota.crc, upload.buf, upload.currentSize);
+        if (!otaStage(upload.buf, upload.currentSize)) {
+            otaFail("flash write failed", 500);
+            return;
+        }
+        ota.received += upload.currentSize;
+    } else if (upload.status == UPLOAD_FILE_END || upload.status == UPLOAD_FILE_ABORTED) {
+        if (!Update.isRunning()) return;
+        if (upload.status == UPLOAD_FILE_ABORTED) otaFail("upload aborted");
+        if (ota.received != ota.expected) otaFail("short upload");
+        if (server.hasArg("crc") && strtoul(server.arg("crc").c_str(), nullptr, 16) != ota.crc) {
+            otaFail("crc mismatch");
+        }
         
-        server.send(200, F("text/html"), generateCompactHTML(F("Word Clock Setup"), body, script));
-    });
+        // Updater has no abort: a digest that cannot match makes end()
+        // discard the staged file instead of committing it
+        if (!ota.error && !otaFlushHeld()) otaFail("flash write failed", 500);
+        if (ota.error) Update.setMD5("00000000000000000000000000000000");
+        if (!Update.end() && !ota.error) otaFail(Update.getError() == UPDATE_ERROR_MD5 ? "md5 mismatch" : "staging failed");
+    }
+}
+
+void otaUploadDone() {
+    if (!ota.active) {
+        sendJsonError(400, "no image");
+        return;
+    }
+    ota.active = false;
+    if (ota.errorCode == 401) {
+        server.requestAuthentication();
+        return;
+    }
+    if (ota.error) {
+        if (ota.errorCode == 503) {
+            size_t left = otaRunningImageSize() - otaRollback.copied;
+            uint32_t seconds = (uint64_t)(left / OTA_COPY_CHUNK + 1) * OTA_COPY_STEP_US / 1000000 + 1;
+            server.sendHeader("Retry-After", String(seconds));
+        }
+        sendJsonError(ota.errorCode, ota.error);
+        return;
+    }
     
-    server.on("/scan", HTTP_GET, []() {
-        String html = "";
-        int n = WiFi.scanNetworks();
-        
-        for (int i = 0; i < min(n, 10); i++) {
-            html += F("<div onclick='sel(\"");
-            html += WiFi.SSID(i);
-            html += F("\")'>");
-            html += WiFi.SSID(i);
-            html += F(" (");
-            html += WiFi.RSSI(i);
-            html += F("dBm)</div>");
+    {
+        StaticJsonDocument<96> reply;
+        reply["staged"] = true;
+        reply["bytes"] = ota.received;
+        char crc[9];
+        snprintf(crc, sizeof(crc), "%08lx", (unsigned long)ota.crc);
+        reply["crc"] = crc;
+        sendJson(200, reply);
+    }
+    
+    trace(TRACE_OTA, 1, ota.received);
+    // Only an image that can be rolled back is on trial
+    if (otaRollback.state == OTA_ROLLBACK_READY) {
+        File trial = LittleFS.open(OTA_TRIAL_FILE, "w");
+        if (trial) {
+            trial.write((uint8_t)0);
+            trial.close();
         }
-        
-        server.send(200, F("text/html"), html);
-    });
+    }
     
-    server.on("/save", HTTP_POST, []() {
-        strlcpy(config.ssid, server.arg("ssid").c_str(), sizeof(config.ssid));
-        strlcpy(config.password, server.arg("password").c_str(), sizeof(config.password));
-        config.timezoneOffset = server.arg("timezone").toInt();
-        config.brightness = server.arg("brightness").toInt();
-        config.daylightSaving = server.hasArg("daylight_saving");
-        
-        saveConfiguration();
-        
-        String body = F("<h1>Settings Saved!</h1><p>Restarting in <span id='c'>3</span> seconds...</p>");
-        String script = F("let c=3;setInterval(()=>{c--;document.getElementById('c').textContent=c;if(c<=0)window.close()},1000)");
-        
-        server.send(200, F("text/html"), generateCompactHTML(F("Saved"), body, script));
-        delay(1000);
-        rp2040.restart();
-    });
+    logPrintf("OTA: image staged, restarting\n");
+    requestRestart();
+}
+
+void setupOtaRoutes() {
+    onRoute("/update", HTTP_POST, otaUploadDone, otaUploadChunk);
+}
+
+// Counts boots of an unconfirmed image and restores the saved one when it
+// keeps failing
+void otaBootCheck() {
+    File trial = LittleFS.open(OTA_TRIAL_FILE, "r");
+    if (!trial) {
+        // A copy made for an upload that never came, or of another image
+        LittleFS.remove(OTA_ROLLBACK_FILE);
+        return;
+    }
+    int boots = trial.read() + 1;
+    trial.close();
+    otaTrial = true;
     
-    server.on("/status", HTTP_GET, []() {
-        String body = F("<h1>Status</h1>");
-        body += F("<div style='margin:10px 0;padding:10px;background:#f9f9f9'>WiFi: ");
-        body += wifiConnected ? F("Connected") : F("Disconnected");
-        body += F("</div>");
-        body += F("<div style='margin:10px 0;padding:10px;background:#f9f9f9'>Time: ");
-        getCurrentTime();
-        body += String(currentTime.hour) + ":";
-        if (currentTime.min < 10) body += "0";
-        body += String(currentTime.min);
-        body += F("</div>");
-        
-        server.send(200, F("text/html"), generateCompactHTML(F("Status"), body));
-    });
+    if (boots < OTA_TRIAL_BOOTS) {
+        trial = LittleFS.open(OTA_TRIAL_FILE, "w");
+        if (trial) {
+            trial.write((uint8_t)boots);
+            trial.close();
+        }
+        // Still the last confirmed image, also for an upload during the trial
+        if (LittleFS.exists(OTA_ROLLBACK_FILE)) otaRollback.state = OTA_ROLLBACK_READY;
+        // A hang or fault has to count as a failed boot too; fed by schedulerRun()
+        rp2040.wdt_begin(OTA_WATCHDOG_MS);
+        logPrintf("OTA: unconfirmed image, boot %d of %d\n", boots, OTA_TRIAL_BOOTS);
+        return;
+    }
     
-    server.on("/reset", HTTP_POST, []() {
-        resetConfiguration();
-        server.send(200, F("text/html"), generateCompactHTML(F("Reset"), F("<h1>Factory Reset Complete</h1><p>Restarting...</p>")));
-        delay(1000);
-        rp2040.restart();
-    });
+    LittleFS.remove(OTA_TRIAL_FILE);
+    otaTrial = false;
+    if (!LittleFS.exists(OTA_ROLLBACK_FILE)) {
+        logPrintf("OTA: new image never confirmed and no rollback copy, keeping it\n");
+        return;
+    }
     
-    server.on("/restart", HTTP_POST, []() {
-        server.send(200, F("text/html"), generateCompactHTML(F("Restart"), F("<h1>Restarting...</h1>")));
-        delay(1000);
-        rp2040.restart();
-    });
+    logPrintf("OTA: new image never confirmed, rolling back\n");
+    trace(TRACE_OTA, 3, 0);
+    picoOTA.begin();
+    picoOTA.addFile(OTA_ROLLBACK_FILE);
+    picoOTA.commit();
+    rp2040.reboot();
+}
+
+// The new image counts as good once it has stayed up for a while
+void otaConfirm() {
+    if (!otaTrial || millis() < OTA_CONFIRM_MS) return;
+    otaTrial = false;
+    watchdog_disable();
+    LittleFS.remove(OTA_TRIAL_FILE);
+    LittleFS.remove(OTA_ROLLBACK_FILE);
+    otaRollback.state = OTA_ROLLBACK_NONE;
+    logPrintf("OTA: new image confirmed\n");
+}
+
+// ==================== TRACE ====================
+// Text goes through logPrintf(), never straight to the port, so a slow
+// or absent USB host can't stall core 0. Events go out as 15-byte frames
+// between the text log lines:
+//   0xA5 0x5A, type, core, arg0 (LE16), time us (LE32), arg1 (LE32), XOR
+// tools/trace_decode.py splits them from the text again. Sending "L<n>"
+// on the same port sets the trace level at runtime.
+#define TRACE_FRAME_SIZE 15
+
+void trace(uint8_t type, uint16_t arg0, uint32_t arg1) {
+    if (TRACE_LEVELS[type] > traceLevel) return;
     
-    server.onNotFound([]() {
-        server.sendHeader("Location", "/");
-        server.send(302);
-    });
+    uint8_t core = get_core_num();
+    TraceRing& ring = traceRings[core];
+    uint32_t irq = save_and_disable_interrupts();   // An ISR on this core may trace too
+    uint32_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) >= (1 << TRACE_RING_BITS)) {
+        ring.dropped++;
+    } else {
+        TraceEvent& event = ring.events[head & ((1 << TRACE_RING_BITS) - 1)];
+        event.timeUs = time_us_32();
+        event.type = type;
+        event.core = core;
+        event.arg0 = arg0;
+        event.arg1 = arg1;
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+    restore_interrupts(irq);
+}
+
+// Core 0 only, outside interrupts
+void logPrintf(const char* format, ...) {
+    char line[LOG_LINE_MAX];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length <= 0) return;
+    if (length >= (int)sizeof(line)) {
+        length = sizeof(line) - 1;
+        line[length - 1] = '\n';
+    }
+    
+    if (logRing.head - logRing.tail + length > sizeof(logRing.text)) {
+        logRing.dropped++;
+        return;
+    }
+    for (int i = 0; i < length; i++) {
+        logRing.text[logRing.head++ & (sizeof(logRing.text) - 1)] = line[i];
+    }
+}
+
+// False while a line is only partly out, so no trace frame splits it
+bool logDrain() {
+    const uint32_t mask = sizeof(logRing.text) - 1;
+    while (logRing.tail != logRing.head) {
+        int room = TRACE_PORT.availableForWrite();
+        if (room <= 0) break;
+        uint32_t offset = logRing.tail & mask;
+        size_t n = min((size_t)room, (size_t)min(logRing.head - logRing.tail, mask + 1 - offset));
+        TRACE_PORT.write((const uint8_t*)logRing.text + offset, n);
+        logRing.tail += n;
+    }
+    if (logRing.tail == logRing.head && logRing.dropped != logRing.droppedReported) {
+        uint32_t lost = logRing.dropped - logRing.droppedReported;
+        logRing.droppedReported = logRing.dropped;
+        logPrintf("(%lu log lines dropped)\n", (unsigned long)lost);
+    }
+    return logRing.tail == logRing.head || logRing.text[(logRing.tail - 1) & mask] == '\n';
+}
+
+bool traceSend(const TraceEvent& event) {
+    if (TRACE_PORT.availableForWrite() < TRACE_FRAME_SIZE) return false;
+    
+    uint8_t frame[TRACE_FRAME_SIZE] = {0xA5, 0x5A, event.type, event.core};
+    memcpy(frame + 4, &event.arg0, 2);
+    memcpy(frame + 6, &event.timeUs, 4);
+    memcpy(frame + 10, &event.arg1, 4);
+    uint8_t check = 0;
+    for (int i = 2; i < TRACE_FRAME_SIZE - 1; i++) check ^= frame[i];
+    frame[TRACE_FRAME_SIZE - 1] = check;
+    TRACE_PORT.write(frame, TRACE_FRAME_SIZE);
+    return true;
+}
+
+// Reads "L<digit>" commands from the port
+void traceCommand() {
+    static bool levelNext = false;
+    while (TRACE_PORT.available() > 0) {
+        int c = TRACE_PORT.read();
+        if (levelNext && c >= '0' && c <= '9') {
+            traceLevel = c - '0';
+            logPrintf("Trace level %d\n", traceLevel);
+        }
+        levelNext = c == 'L';
+    }
+}
+
+// Sends only what fits in the port's transmit buffer; the rest waits for
+// the next loop() pass instead of blocking it. True while some is left.
+bool traceDrain() {
+    traceCommand();
+    if (!logDrain()) return true;
+    bool left = logRing.tail != logRing.head;
+    
+    for (int core = 0; core < 2; core++) {
+        TraceRing& ring = traceRings[core];
+        uint32_t dropped = ring.dropped;
+        if (dropped != ring.droppedReported) {
+            TraceEvent lost = {time_us_32(), TRACE_DROPPED, (uint8_t)core, 0, dropped - ring.droppedReported};
+            if (!traceSend(lost)) return true;
+            ring.droppedReported = dropped;
+        }
+        
+        uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+        uint32_t head = ring.head.load(std::memory_order_acquire);
+        while (tail != head) {
+            if (!traceSend(ring.events[tail & ((1 << TRACE_RING_BITS) - 1)])) break;
+            tail++;
+        }
+        ring.tail.store(tail, std::memory_order_release);
+        left |= tail != head;
+    }
+    return left;
 }
 
 // ==================== BUTTON HANDLING ====================
+void configButtonISR() {
+    buttonEdgeAt = millis();
+    buttonEdgePending = true;
+    taskKick(TASK_BUTTON);
+    trace(TRACE_BUTTON_EDGE, digitalRead(CONFIG_BUTTON_PIN));
+}
+
 void handleConfigButton() {
-    static unsigned long lastCheck = 0;
-    if (millis() - lastCheck < 50) return;  // Debounce
-    lastCheck = millis();
+    if (!buttonEdgePending) return;
+    if (millis() - buttonEdgeAt < BUTTON_DEBOUNCE) return;  // Wait for the contacts to settle
+    buttonEdgePending = false;
     
     bool currentState = digitalRead(CONFIG_BUTTON_PIN) == LOW;
     
@@ -827,71 +3827,307 @@ void enterConfigMode() {
     cleanupWiFi();
     configMode = true;
     
+    if (minuteAlarmId > 0) cancel_alarm(minuteAlarmId);
+    minuteAlarmId = 0;
+    scheduleFrame(Frame{});
+    
     // Immediately start showing config mode animation
     configModeAnimation();
-    FastLED.show();
     
     WiFi.mode(WIFI_AP);
     WiFi.softAP(AP_SSID, AP_PASSWORD);
     
     dnsServer.start(DNS_PORT, "*", WiFi.softAPIP());
     setupWebServer();
-    server.begin();
+    webServerBegin();
+    
+    startWiFiScan();
+}
+
+// Back to station mode once the portal has saved a network, no reboot
+void leaveConfigMode() {
+    dnsServer.stop();
+    WiFi.softAPdisconnect(true);
+    configMode = false;
+    
+    // Drop the portal animation; the time frame follows once it is known
+    if (!wallClock.valid) publishFrame(Frame{});
+    requestDisplayUpdate();
+    
+    wifiManager.retryDelay = WIFI_RETRY_MIN;
+    connectToWiFi();
 }
 
 // ==================== SETUP ====================
 void setup() {
-    Serial.begin(9600);
+    Serial.begin(TRACE_BAUD);
     
     setupEEPROM();
     
     pinMode(CONFIG_BUTTON_PIN, INPUT_PULLUP);
-    analogReadResolution(12);
-    
-    FastLED.addLeds<LED_TYPE, LED_PIN, COLOR_ORDER>(leds, NUM_LEDS).setCorrection(TypicalLEDStrip);
-    FastLED.setBrightness(BRIGHTNESS);
+    attachInterrupt(digitalPinToInterrupt(CONFIG_BUTTON_PIN), configButtonISR, CHANGE);
+    ambientLightInit();
+    layoutBegin();
+    webAssetsBegin();
+    otaBootCheck();
     
     loadConfiguration();
-    initializeRTC();
-    startupAnimation();
+    clockRestore();
+    if (!tzBegin(config.timezone)) {
+        logPrintf("Invalid timezone rule '%s', using UTC\n", config.timezone);
+    }
     
-    if (!config.configured) {
+    // The display keeps running on the local clock while the connection comes up
+    if (!config.configured || !connectToWiFi()) {
         enterConfigMode();
-    } else {
-        if (connectToWiFi()) {
-            initializeNTPClient();
-            syncTimeWithNTP();
-        } else {
-            enterConfigMode();
-        }
     }
 }
 
-// ==================== MAIN LOOP ====================
-void loop() {
+// Core 1: LED output only, so blocking network calls on core 0 can never
+// stall or tear the display
+void setup1() {
+    ws2812Init();
+    startupAnimation();
+}
+
+// ==================== SCHEDULER ====================
+// loop() runs every task that is due, in table order so the network comes
+// first, then sleeps until the earliest deadline. A task returns how long
+// until it wants to run again; interrupts make one due at once through
+// taskKick(). Packets and USB serial wake the core without a kick, which
+// is why the network and time tasks also run on every pass.
+#define TASK_PARKED 0xFFFFFFFFUL     // Due only when kicked
+#define TASK_PORTAL 0x01
+#define TASK_STATION 0x02
+#define TASK_ANY (TASK_PORTAL | TASK_STATION)
+
+uint32_t taskNetwork() {
+    if (configMode) dnsServer.processNextRequest();
+    if (webServerRunning) server.handleClient();
+    if (wifiConnected && !configMode) MDNS.update();
+    return NETWORK_POLL_US;
+}
+
+uint32_t taskTimeSync() {
+    if (wifiConnected) {
+        if (ntpActive()) checkNTPSync();
+        if (config.lanTime) lanTimeService();
+    }
+    return NETWORK_POLL_US;
+}
+
+// Kicked by the edge interrupt; waits out the debounce before reading
+uint32_t taskButton() {
+    uint32_t settled = millis() - buttonEdgeAt;
+    if (buttonEdgePending && settled < BUTTON_DEBOUNCE) return (BUTTON_DEBOUNCE - settled) * 1000;
     handleConfigButton();
-    
-    if (configMode) {
-        dnsServer.processNextRequest();
-        server.handleClient();
-        configModeAnimation();
-    } else {
-        static unsigned long lastTimeUpdate = 0;
+    return TASK_PARKED;
+}
+
+uint32_t taskConfig() {
+    applyPendingConfig();
+    if (!configManager.restartPending) return TASK_PARKED;
+    return max(0L, (long)(configManager.restartAt - millis())) * 1000;
+}
+
+// Redraw on the minute alarm, a new sync or a brightness step;
+// without any idea of the time the face stays dark
+uint32_t taskDisplay() {
+    if (displayUpdatePending) {
+        displayUpdatePending = false;
+        bool fired = minuteAlarmFired;
+        minuteAlarmFired = false;
+        if (wallClock.valid) {
+            // Inside the lead window the next minute is already on its way in.
+            // After the alarm, drift or a slew since arming can leave the
+            // clock a little short of the boundary, so look at least that far.
+            int64_t aheadUs = displayLeadUs();
+            if (fired) aheadUs = max(aheadUs, minuteBoundaryUs - clockNowUs());
+            getCurrentTime(aheadUs);
+            displayTime();
+            armMinuteAlarm(fired ? minuteBoundaryUs : 0);
+        }
+    }
+    return TASK_PARKED;
+}
+
+uint32_t taskWiFi() {
+    handleWiFi();
+    return WIFI_POLL_US;
+}
+
+uint32_t taskBrightness() {
+    updateBrightness();
+    return AMBIENT_FILTER_INTERVAL * 1000;
+}
+
+uint32_t taskAnimation() {
+    configModeAnimation();
+    return ANIMATION_STEP_US;
+}
+
+// The portal keeps its list fresh; in station mode only scans asked for
+// through /scan
+uint32_t taskScan() {
+    if (configMode || scanCache.scanning) handleWiFiScan();
+    return SCAN_POLL_US;
+}
+
+uint32_t taskSnapshot() {
+    checkClockSnapshot();
+    return HOUSEKEEPING_US;
+}
+
+uint32_t taskOta() {
+    if (otaRollbackStep()) return OTA_COPY_STEP_US;
+    otaConfirm();
+    return otaTrial ? HOUSEKEEPING_US : TASK_PARKED;
+}
+
+// Core 0 output drains on the pass that made it; with tracing off and
+// nothing backed up only USB input, which wakes the core, needs a look
+uint32_t taskTrace() {
+    if (traceDrain()) return TRACE_DRAIN_US;
+    return traceLevel > 0 ? TRACE_IDLE_US : TASK_PARKED;
+}
+
+// Must match TaskId
+Task tasks[TASK_COUNT] = {
+    {"network", taskNetwork, TASK_ANY, true, 20000},
+    {"time_sync", taskTimeSync, TASK_STATION, true, 5000},
+    {"button", taskButton, TASK_ANY, false, 1000},
+    {"config", taskConfig, TASK_ANY, false, 100000},   // Flash commit, WiFi rejoin
+    {"display", taskDisplay, TASK_STATION, false, 2000},
+    {"wifi", taskWiFi, TASK_STATION, false, 20000},
+    {"brightness", taskBrightness, TASK_STATION, false, 500},
+    {"animation", taskAnimation, TASK_PORTAL, false, 500},
+    {"scan", taskScan, TASK_ANY, false, 5000},
+    {"snapshot", taskSnapshot, TASK_ANY, false, 50000},  // May commit a journal record
+    {"ota", taskOta, TASK_ANY, false, 50000},
+    {"trace", taskTrace, TASK_ANY, true, 2000},
+};
+
+// Safe from interrupts on core 0: only sets the flag
+void taskKick(TaskId id) {
+    tasks[id].kicked = true;
+}
+
+void schedulerRun() {
+    static uint8_t lastMode = 0;
+    rp2040.wdt_reset();     // Only armed while an OTA image is on trial
+    for (Task& task : tasks) {
+        // Checked per task: the button or config task may switch modes mid-pass
+        uint8_t mode = configMode ? TASK_PORTAL : TASK_STATION;
+        if (mode != lastMode) {
+            // Tasks of the other mode start fresh instead of all being late
+            for (Task& other : tasks) other.dueUs = 0;
+            lastMode = mode;
+        }
+        if (!(task.modes & mode)) continue;
+        uint64_t now = time_us_64();
+        bool due = now >= task.dueUs;
+        if (!due && !task.kicked && !task.everyPass) continue;
+        if (due && task.dueUs && now - task.dueUs > TASK_LATE_US) task.late++;
         
-        updateBrightness();
+        task.kicked = false;   // Before running: a kick from here on counts again
+        uint32_t startedAt = time_us_32();
+        uint32_t next = task.run();
+        uint32_t elapsed = time_us_32() - startedAt;
         
-        if (wifiConnected && timeClient != nullptr) {
-            checkNTPSync();
+        task.runs++;
+        if (elapsed > task.budgetUs) {
+            task.overruns++;
+            trace(TRACE_TASK_OVERRUN, &task - tasks, elapsed);   // Never blocks, unlike Serial
         }
-        
-        // Only update time display once per second
-        if (millis() - lastTimeUpdate > 1000) {
-            getCurrentTime();
-            displayTime();
-            FastLED.show();
-            lastTimeUpdate = millis();
+        task.worstUs = max(task.worstUs, elapsed);
+        task.dueUs = next == TASK_PARKED ? UINT64_MAX : time_us_64() + next;
+    }
+}
+
+// Until the earliest deadline; any interrupt (minute alarm, button edge,
+// network) ends the sleep early
+void schedulerSleep() {
+    uint8_t mode = configMode ? TASK_PORTAL : TASK_STATION;
+    uint64_t next = UINT64_MAX;
+    for (const Task& task : tasks) {
+        if (!(task.modes & mode)) continue;
+        if (task.kicked) return;
+        next = min(next, task.dueUs);
+    }
+    if (next > time_us_64()) best_effort_wfe_or_timeout(from_us_since_boot(next));
+}
+
+void printTaskMetrics(Print& out) {
+    struct Series {
+        const char* name;
+        const char* type;
+        const char* help;
+        uint32_t Task::*field;
+        double scale;
+    };
+    static const Series SERIES[] = {
+        {"wordclock_task_runs_total", "counter", "Scheduler task runs", &Task::runs, 1},
+        {"wordclock_task_overruns_total", "counter", "Task runs over their budget", &Task::overruns, 1},
+        {"wordclock_task_late_total", "counter", "Task runs started late", &Task::late, 1},
+        {"wordclock_task_worst_seconds", "gauge", "Longest task run since boot", &Task::worstUs, 1e-6},
+    };
+    for (const Series& series : SERIES) {
+        out.printf("# HELP %s %s\n# TYPE %s %s\n", series.name, series.help, series.name, series.type);
+        for (const Task& task : tasks) {
+            out.printf("%s{task=\"%s\"} %.9g\n", series.name, task.name, task.*series.field * series.scale);
         }
     }
+}
+
+// ==================== MAIN LOOP ====================
+void loop() {
+    uint32_t loopStart = time_us_32();
+    schedulerRun();
+    metricsObserve(metrics.loopTime, time_us_32() - loopStart);
+    schedulerSleep();
+}
+
+void loop1() {
+    static uint32_t frameSequence = 0;
+    static uint32_t scheduleSequence = 0;
+    static Frame scheduled;
+    static bool scheduledPending = false;
+    Frame frame;
+    
+    if (frameMailbox.take(frame, frameSequence)) {
+        showFrame(frame);
+    }
+    if (scheduleMailbox.take(scheduled, scheduleSequence)) {
+        scheduledPending = scheduled.showAtUs != 0;
+    }
+    if (scheduledPending && (int64_t)(time_us_64() - scheduled.showAtUs) >= 0) {
+        scheduledPending = false;
+        showFrame(scheduled);
+    }
+    stepTransition();
+    ws2812Service();
+    
+    // Sleep until the next transition frame, dither refresh, latch or
+    // scheduled flip; with none pending until core 0 publishes. The DMA
+    // handler and the flash pause interrupt wake it as well.
+    uint32_t now = time_us_32();
+    uint32_t waitUs = UINT32_MAX;
+    if (transition.active) waitUs = min(waitUs, usUntil(transition.nextFrameUs, now));
+    if (ws2812Dithering && !ws2812Pending) waitUs = min(waitUs, usUntil(ws2812EncodedAt + WS2812_DITHER_US, now));
+    if (ws2812Pending && !ws2812DmaActive) waitUs = min(waitUs, usUntil(ws2812DoneAt + WS2812_LATCH_US, now));
+    if (scheduledPending) {
+        int64_t untilFlip = (int64_t)(scheduled.showAtUs - time_us_64());
+        waitUs = min(waitUs, (uint32_t)constrain(untilFlip, (int64_t)0, (int64_t)UINT32_MAX - 1));
+    }
     
-    delay(10);
-}
\ No newline at end of file
+    if (waitUs == UINT32_MAX) {
+        __wfe();
+    } else if (waitUs > 0) {
+        best_effort_wfe_or_timeout(make_timeout_time_us(waitUs));
+    }
+}
+
+// Time left before a 32-bit timer deadline, 0 once it has passed
+uint32_t usUntil(uint32_t deadline, uint32_t now) {
+    return (int32_t)(deadline - now) > 0 ? deadline - now : 0;
+}
@@ -0,0 +1,403 @@
+// Pure clock logic shared by the firmware and the native test build:
+// word masks, the built-in face, frame building, the power model and the
+// POSIX TZ engine.
+// Nothing in here may depend on Arduino, FastLED or the Pico SDK.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ctype.h>
+
+// ==================== LED MAPPING FOR DUTCH WORDS ====================
+constexpr int UUR_LEDS[] = {2, 3, 4};
+constexpr int HETIS_LEDS[] = {51, 52, 53, 54, 55};
+constexpr int AM_LED = 1;
+constexpr int PM_LED = 0;
+
+constexpr int HOUR_LEDS[][3] = {
+    {5, -1, -1},      // 12/0 (TWAALF)
+    {16, -1, -1},     // 1 (EEN)
+    {15, -1, -1},     // 2 (TWEE) 
+    {14, -1, -1},     // 3 (DRIE)
+    {6, -1, -1},      // 4 (VIER)
+    {7, -1, -1},      // 5 (VIJF)
+    {8, -1, -1},      // 6 (ZES)
+    {9, -1, -1},      // 7 (ZEVEN)
+    {10, -1, -1},     // 8 (ACHT)
+    {11, -1, -1},     // 9 (NEGEN)
+    {12, -1, -1},     // 10 (TIEN)
+    {13, -1, -1}      // 11 (ELF)
+};
+
+constexpr int PRECIES_LEDS[] = {36, 37, 38, 39, 40, 41, 42};
+constexpr int RUIM_LEDS[] = {47, 48, 49, 50};
+constexpr int BIJNA_LEDS[] = {43, 44, 45, 46};
+constexpr int VIJF_MIN_LED = 35;
+constexpr int TIEN_MIN_LED = 34;
+constexpr int KWART_LEDS[] = {29, 30, 31, 32, 33};
+constexpr int VOOR_LEDS[] = {21, 22, 23, 24};
+constexpr int OVER_LEDS[] = {25, 26, 27, 28};
+constexpr int HALF_LEDS[] = {17, 18, 19, 20};
+
+// ==================== FRAME LOOKUP TABLES ====================
+// A frame is a bitmask with one bit per LED (bit i lights leds[i]).
+// All words and minute rules are folded into masks at compile time, so
+// building a frame costs a handful of ORs.
+typedef uint64_t FrameMask;
+
+constexpr int BUILTIN_FACE_LEDS = 56;
+
+
+template <size_t N>
+constexpr FrameMask wordMask(const int (&ledsArray)[N]) {
+    FrameMask mask = 0;
+    for (size_t i = 0; i < N; i++) {
+        if (ledsArray[i] >= 0) mask |= FrameMask(1) << ledsArray[i];
+    }
+    return mask;
+}
+
+constexpr FrameMask ledMask(int led) {
+    return FrameMask(1) << led;
+}
+
+constexpr FrameMask UUR_MASK = wordMask(UUR_LEDS);
+constexpr FrameMask HETIS_MASK = wordMask(HETIS_LEDS);
+constexpr FrameMask AM_MASK = ledMask(AM_LED);
+constexpr FrameMask PM_MASK = ledMask(PM_LED);
+constexpr FrameMask PRECIES_MASK = wordMask(PRECIES_LEDS);
+constexpr FrameMask RUIM_MASK = wordMask(RUIM_LEDS);
+constexpr FrameMask BIJNA_MASK = wordMask(BIJNA_LEDS);
+constexpr FrameMask VIJF_MIN_MASK = ledMask(VIJF_MIN_LED);
+constexpr FrameMask TIEN_MIN_MASK = ledMask(TIEN_MIN_LED);
+constexpr FrameMask KWART_MASK = wordMask(KWART_LEDS);
+constexpr FrameMask VOOR_MASK = wordMask(VOOR_LEDS);
+constexpr FrameMask OVER_MASK = wordMask(OVER_LEDS);
+constexpr FrameMask HALF_MASK = wordMask(HALF_LEDS);
+
+// Words per five-minute block, without PRECIES/RUIM/BIJNA
+constexpr FrameMask MINUTE_BLOCK_MASKS[13] = {
+    UUR_MASK,                            // :00 "[uur] uur"
+    VIJF_MIN_MASK | OVER_MASK,           // :05 "vijf over"
+    TIEN_MIN_MASK | OVER_MASK,           // :10 "tien over"
+    KWART_MASK | OVER_MASK,              // :15 "kwart over"
+    TIEN_MIN_MASK | VOOR_MASK | HALF_MASK,   // :20 "tien voor half"
+    VIJF_MIN_MASK | VOOR_MASK | HALF_MASK,   // :25 "vijf voor half"
+    HALF_MASK,                           // :30 "half"
+    VIJF_MIN_MASK | OVER_MASK | HALF_MASK,   // :35 "vijf over half"
+    TIEN_MIN_MASK | OVER_MASK | HALF_MASK,   // :40 "tien over half"
+    KWART_MASK | VOOR_MASK,              // :45 "kwart voor"
+    TIEN_MIN_MASK | VOOR_MASK,           // :50 "tien voor"
+    VIJF_MIN_MASK | VOOR_MASK,           // :55 "vijf voor"
+    UUR_MASK                             // :60 "[volgend uur] uur"
+};
+
+constexpr FrameMask minuteMask(int minute) {
+    // PRECIES on the block, RUIM 1-2 minutes after, BIJNA 1-2 minutes before
+    int block = (minute + 2) / 5;
+    int offset = minute - block * 5;
+    FrameMask qualifier = (offset == 0) ? PRECIES_MASK : (offset > 0 ? RUIM_MASK : BIJNA_MASK);
+    FrameMask words = MINUTE_BLOCK_MASKS[block];
+    // "Het is ruim over [uur]" has no minute word
+    if (block == 0 && offset > 0) words = OVER_MASK;
+    return qualifier | words;
+}
+
+struct MinuteTable {
+    FrameMask masks[60];
+    constexpr MinuteTable() : masks() {
+        for (int m = 0; m < 60; m++) masks[m] = minuteMask(m);
+    }
+};
+
+struct HourTable {
+    FrameMask masks[12];
+    constexpr HourTable() : masks() {
+        for (int h = 0; h < 12; h++) masks[h] = wordMask(HOUR_LEDS[h]);
+    }
+};
+
+constexpr MinuteTable MINUTE_FRAMES;
+constexpr HourTable HOUR_FRAMES;
+
+static_assert(MINUTE_FRAMES.masks[0] == (PRECIES_MASK | UUR_MASK), "precies uur");
+static_assert(MINUTE_FRAMES.masks[2] == (RUIM_MASK | OVER_MASK), "ruim over");
+static_assert(MINUTE_FRAMES.masks[29] == (BIJNA_MASK | HALF_MASK), "bijna half");
+static_assert(MINUTE_FRAMES.masks[59] == (BIJNA_MASK | UUR_MASK), "bijna uur");
+
+constexpr FrameMask allLedsMask(int count) {
+    return (count >= 64) ? ~FrameMask(0) : (FrameMask(1) << count) - 1;
+}
+
+// ==================== CLOCK FACE LAYOUT ====================
+// Everything buildTimeFrame() needs to know about a face. The built-in
+// Dutch face is a constexpr object, so it sits in flash and is read in
+// place through XIP. A layout file in LittleFS replaces it at boot; the
+// file is parsed once into a RAM face, and per frame both cost the same.
+struct ClockFace {
+    char name[16];
+    uint8_t numLeds;
+    uint8_t hourAdvance;    // From this minute on the text names the next hour
+    FrameMask alwaysOn;     // HET IS
+    FrameMask am;
+    FrameMask pm;
+    FrameMask all;
+    FrameMask hours[12];
+    FrameMask minutes[60];
+};
+
+constexpr ClockFace builtinFace() {
+    ClockFace face = {};
+    const char name[] = "Nederlands";
+    for (size_t i = 0; i < sizeof(name); i++) face.name[i] = name[i];
+    face.numLeds = BUILTIN_FACE_LEDS;
+    face.hourAdvance = 18;
+    face.alwaysOn = HETIS_MASK;
+    face.am = AM_MASK;
+    face.pm = PM_MASK;
+    face.all = allLedsMask(BUILTIN_FACE_LEDS);
+    for (int h = 0; h < 12; h++) face.hours[h] = HOUR_FRAMES.masks[h];
+    for (int m = 0; m < 60; m++) face.minutes[m] = MINUTE_FRAMES.masks[m];
+    return face;
+}
+
+constexpr ClockFace BUILTIN_FACE = builtinFace();
+
+// Later in the hour the text refers to the next hour
+inline FrameMask faceFrame(const ClockFace& face, int hour, int minute) {
+    if (minute >= face.hourAdvance) {
+        hour++;
+        if (hour >= 24) hour = 0;
+    }
+    
+    FrameMask frame = face.alwaysOn | face.minutes[minute] | face.hours[hour % 12];
+    frame |= (hour < 12) ? face.am : face.pm;
+    return frame;
+}
+
+// ==================== POWER MODEL ====================
+// A frame lights every LED in a group with the same colour, so its supply
+// current is the LED count of each group times that colour's draw. Loads
+// are in uA at brightness 255; the per-colour draw comes from the colour
+// LUT in the firmware.
+inline uint32_t frameLoadUa(FrameMask mask, FrameMask alwaysOn, uint32_t colorUa, uint32_t alwaysOnUa) {
+    return (uint32_t)__builtin_popcountll(mask & ~alwaysOn) * colorUa +
+           (uint32_t)__builtin_popcountll(mask & alwaysOn) * alwaysOnUa;
+}
+
+// Current at a brightness, with the scale ws2812Show() applies to every
+// level: (brightness * 257 + 1) / 65536
+inline uint32_t scaledLoadUa(uint32_t loadUa, uint8_t brightness) {
+    return ((uint64_t)loadUa * (brightness * 257u + 1)) >> 16;
+}
+
+// Highest brightness up to the requested one that keeps the load within
+// the budget
+inline uint8_t powerLimitBrightness(uint8_t brightness, uint32_t loadUa, uint32_t budgetUa) {
+    if (scaledLoadUa(loadUa, brightness) <= budgetUa) return brightness;
+    uint64_t scale = ((uint64_t)budgetUa << 16 | 0xFFFF) / loadUa;
+    return scale <= 1 ? 0 : (uint8_t)((scale - 1) / 257);
+}
+
+// ==================== TIMEZONE ====================
+// POSIX TZ rules such as "CET-1CEST,M3.5.0,M10.5.0/3". The rule is parsed
+// once; tzOffsetAt() then caches the offset together with the UTC period
+// it is valid for, so a lookup is one compare until a transition passes.
+enum TzRuleKind {
+    TZ_RULE_MONTH,    // Mm.w.d: day d of week w (5 = last) of month m
+    TZ_RULE_JULIAN,   // Jn: day 1-365, February 29 never counted
+    TZ_RULE_DAY       // n: day 0-365, February 29 counted
+};
+
+struct TzTransition {
+    TzRuleKind kind;
+    int16_t month;
+    int16_t week;
+    int16_t day;
+    int32_t time;     // Local seconds after midnight
+};
+
+struct TzRule {
+    int32_t stdOffset;    // Seconds east of UTC
+    int32_t dstOffset;
+    bool hasDst;
+    TzTransition start;   // Into DST, in standard local time
+    TzTransition end;     // Out of DST, in DST local time
+};
+
+struct TzState {
+    TzRule rule;
+    int32_t offset;
+    bool inDst;
+    int64_t validFrom;    // UTC period the cached offset applies to
+    int64_t validUntil;
+};
+
+
+// Days since 1970-01-01 for a proleptic Gregorian date (H. Hinnant)
+inline int32_t daysFromCivil(int32_t year, int32_t month, int32_t day) {
+    year -= month <= 2;
+    int32_t era = (year >= 0 ? year : year - 399) / 400;
+    int32_t yoe = year - era * 400;
+    int32_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+inline void civilFromDays(int32_t days, int32_t& year, int32_t& month, int32_t& day) {
+    days += 719468;
+    int32_t era = (days >= 0 ? days : days - 146096) / 146097;
+    int32_t doe = days - era * 146097;
+    int32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int32_t mp = (5 * doy + 2) / 153;
+    day = doy - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = yoe + era * 400 + (month <= 2);
+}
+
+inline bool isLeapYear(int32_t year) {
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+inline int daysInMonth(int32_t year, int32_t month) {
+    static const uint8_t DAYS[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    return (month == 2 && isLeapYear(year)) ? 29 : DAYS[month - 1];
+}
+
+// "[+-]hh[:mm[:ss]]" -> seconds
+inline const char* tzParseTime(const char* p, int32_t& seconds) {
+    int32_t sign = 1;
+    if (*p == '+' || *p == '-') {
+        if (*p == '-') sign = -1;
+        p++;
+    }
+    
+    int32_t parts[3] = {0, 0, 0};
+    for (int i = 0; i < 3; i++) {
+        if (!isdigit((unsigned char)*p)) return nullptr;
+        while (isdigit((unsigned char)*p)) parts[i] = parts[i] * 10 + (*p++ - '0');
+        if (*p != ':' || i == 2) break;
+        p++;
+    }
+    
+    seconds = sign * (parts[0] * 3600 + parts[1] * 60 + parts[2]);
+    return p;
+}
+
+inline const char* tzParseName(const char* p) {
+    if (*p == '<') {
+        while (*p && *p != '>') p++;
+        return *p ? p + 1 : nullptr;
+    }
+    const char* start = p;
+    while (isalpha((unsigned char)*p)) p++;
+    return (p - start >= 3) ? p : nullptr;
+}
+
+inline const char* tzParseNumber(const char* p, int16_t& value) {
+    if (!isdigit((unsigned char)*p)) return nullptr;
+    value = 0;
+    while (isdigit((unsigned char)*p)) value = value * 10 + (*p++ - '0');
+    return p;
+}
+
+inline const char* tzParseTransition(const char* p, TzTransition& t) {
+    t.month = t.week = t.day = 0;
+    if (*p == 'M') {
+        t.kind = TZ_RULE_MONTH;
+        if (!(p = tzParseNumber(p + 1, t.month)) || *p != '.') return nullptr;
+        if (!(p = tzParseNumber(p + 1, t.week)) || *p != '.') return nullptr;
+        if (!(p = tzParseNumber(p + 1, t.day))) return nullptr;
+        if (t.month < 1 || t.month > 12 || t.week < 1 || t.week > 5 || t.day > 6) return nullptr;
+    } else if (*p == 'J') {
+        t.kind = TZ_RULE_JULIAN;
+        if (!(p = tzParseNumber(p + 1, t.day)) || t.day < 1 || t.day > 365) return nullptr;
+    } else {
+        t.kind = TZ_RULE_DAY;
+        if (!(p = tzParseNumber(p, t.day)) || t.day > 365) return nullptr;
+    }
+    
+    t.time = 7200;
+    if (*p == '/') p = tzParseTime(p + 1, t.time);
+    return p;
+}
+
+inline bool tzParse(const char* spec, TzRule& rule) {
+    int32_t offset;
+    const char* p = tzParseName(spec);
+    if (!p || !(p = tzParseTime(p, offset))) return false;
+    rule.stdOffset = -offset;  // POSIX counts west of UTC
+    rule.hasDst = false;
+    if (*p == '\0') return true;
+    
+    if (!(p = tzParseName(p))) return false;
+    rule.dstOffset = rule.stdOffset + 3600;
+    if (*p != ',' && *p != '\0') {
+        if (!(p = tzParseTime(p, offset))) return false;
+        rule.dstOffset = -offset;
+    }
+    
+    // Without explicit dates the switch days are implementation defined
+    if (*p != ',') return false;
+    if (!(p = tzParseTransition(p + 1, rule.start)) || *p != ',') return false;
+    if (!(p = tzParseTransition(p + 1, rule.end)) || *p != '\0') return false;
+    
+    rule.hasDst = true;
+    return true;
+}
+
+// Day of the transition in the given year, as days since 1970-01-01
+inline int32_t tzTransitionDay(const TzTransition& t, int32_t year) {
+    if (t.kind == TZ_RULE_JULIAN) {
+        int32_t day = t.day - 1;
+        if (isLeapYear(year) && t.day >= 60) day++;
+        return daysFromCivil(year, 1, 1) + day;
+    }
+    if (t.kind == TZ_RULE_DAY) {
+        return daysFromCivil(year, 1, 1) + t.day;
+    }
+    
+    int32_t first = daysFromCivil(year, t.month, 1);
+    int32_t firstWeekday = ((first % 7) + 11) % 7;  // 1970-01-01 was a Thursday
+    int32_t day = (t.day - firstWeekday + 7) % 7 + (t.week - 1) * 7;
+    while (day >= daysInMonth(year, t.month)) day -= 7;
+    return first + day;
+}
+
+// Recomputes the offset at utc and the UTC period it stays valid for
+inline void tzUpdate(TzState& tz, int64_t utc) {
+    const TzRule& rule = tz.rule;
+    if (!rule.hasDst) {
+        tz.offset = rule.stdOffset;
+        tz.inDst = false;
+        tz.validFrom = INT64_MIN;
+        tz.validUntil = INT64_MAX;
+        return;
+    }
+    
+    int32_t year, month, day;
+    int64_t localDays = (utc + rule.stdOffset) / 86400 - ((utc + rule.stdOffset) % 86400 < 0);
+    civilFromDays((int32_t)localDays, year, month, day);
+    
+    // The surrounding transitions are always within a year either side
+    tz.validFrom = INT64_MIN;
+    tz.validUntil = INT64_MAX;
+    for (int32_t y = year - 1; y <= year + 1; y++) {
+        int64_t start = (int64_t)tzTransitionDay(rule.start, y) * 86400 + rule.start.time - rule.stdOffset;
+        int64_t end = (int64_t)tzTransitionDay(rule.end, y) * 86400 + rule.end.time - rule.dstOffset;
+        
+        if (start <= utc && start > tz.validFrom) {
+            tz.validFrom = start;
+            tz.inDst = true;
+        }
+        if (end <= utc && end > tz.validFrom) {
+            tz.validFrom = end;
+            tz.inDst = false;
+        }
+        if (start > utc && start < tz.validUntil) tz.validUntil = start;
+        if (end > utc && end < tz.validUntil) tz.validUntil = end;
+    }
+    
+    tz.offset = tz.inDst ? rule.dstOffset : rule.stdOffset;
+}
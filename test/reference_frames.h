@@ -0,0 +1,83 @@
+// Reference for the Dutch face, written out the way the text reads
+// instead of derived from the frame tables: one phrase per minute, the
+// hour named from :18 on as the next one, AM/PM following that hour.
+#pragma once
+
+#include <string.h>
+#include "wordclock_core.h"
+
+static const char* const MINUTE_PHRASES[60] = {
+    "precies uur", "ruim over", "ruim over", "bijna vijf over", "bijna vijf over",  // :00
+    "precies vijf over", "ruim vijf over", "ruim vijf over", "bijna tien over", "bijna tien over",  // :05
+    "precies tien over", "ruim tien over", "ruim tien over", "bijna kwart over", "bijna kwart over",  // :10
+    "precies kwart over", "ruim kwart over", "ruim kwart over", "bijna tien voor half", "bijna tien voor half",  // :15
+    "precies tien voor half", "ruim tien voor half", "ruim tien voor half", "bijna vijf voor half", "bijna vijf voor half",  // :20
+    "precies vijf voor half", "ruim vijf voor half", "ruim vijf voor half", "bijna half", "bijna half",  // :25
+    "precies half", "ruim half", "ruim half", "bijna vijf over half", "bijna vijf over half",  // :30
+    "precies vijf over half", "ruim vijf over half", "ruim vijf over half", "bijna tien over half", "bijna tien over half",  // :35
+    "precies tien over half", "ruim tien over half", "ruim tien over half", "bijna kwart voor", "bijna kwart voor",  // :40
+    "precies kwart voor", "ruim kwart voor", "ruim kwart voor", "bijna tien voor", "bijna tien voor",  // :45
+    "precies tien voor", "ruim tien voor", "ruim tien voor", "bijna vijf voor", "bijna vijf voor",  // :50
+    "precies vijf voor", "ruim vijf voor", "ruim vijf voor", "bijna uur", "bijna uur",  // :55
+};
+
+template <size_t N>
+FrameMask referenceLeds(const int (&leds)[N]) {
+    FrameMask mask = 0;
+    for (size_t i = 0; i < N; i++) {
+        if (leds[i] >= 0) mask |= FrameMask(1) << leds[i];
+    }
+    return mask;
+}
+
+// Minute words only; the hour word is added separately
+inline FrameMask referenceWord(const char* word, size_t length) {
+    struct Entry {
+        const char* name;
+        FrameMask mask;
+    };
+    const Entry WORDS[] = {
+        {"precies", referenceLeds(PRECIES_LEDS)},
+        {"ruim", referenceLeds(RUIM_LEDS)},
+        {"bijna", referenceLeds(BIJNA_LEDS)},
+        {"vijf", FrameMask(1) << VIJF_MIN_LED},
+        {"tien", FrameMask(1) << TIEN_MIN_LED},
+        {"kwart", referenceLeds(KWART_LEDS)},
+        {"voor", referenceLeds(VOOR_LEDS)},
+        {"over", referenceLeds(OVER_LEDS)},
+        {"half", referenceLeds(HALF_LEDS)},
+        {"uur", referenceLeds(UUR_LEDS)},
+    };
+    for (const Entry& entry : WORDS) {
+        if (strlen(entry.name) == length && strncmp(entry.name, word, length) == 0) return entry.mask;
+    }
+    return ~FrameMask(0);  // Unknown word: can never match a real frame
+}
+
+inline FrameMask referencePhrase(const char* phrase) {
+    FrameMask mask = 0;
+    while (*phrase) {
+        const char* end = strchr(phrase, ' ');
+        size_t length = end ? (size_t)(end - phrase) : strlen(phrase);
+        mask |= referenceWord(phrase, length);
+        phrase += length;
+        if (*phrase == ' ') phrase++;
+    }
+    return mask;
+}
+
+// Hour shown on the face, 1-12
+inline int referenceHour(int hour, int minute) {
+    if (minute > 17) hour = (hour + 1) % 24;
+    hour %= 12;
+    return hour == 0 ? 12 : hour;
+}
+
+inline FrameMask referenceFrame(int hour, int minute) {
+    FrameMask frame = referenceLeds(HETIS_LEDS) | referencePhrase(MINUTE_PHRASES[minute]);
+    frame |= referenceLeds(HOUR_LEDS[referenceHour(hour, minute) % 12]);
+    
+    int shownHour = minute > 17 ? (hour + 1) % 24 : hour;
+    frame |= FrameMask(1) << (shownHour < 12 ? AM_LED : PM_LED);
+    return frame;
+}
@@ -0,0 +1,132 @@
+// Host microbenchmarks for the render path, to compare across changes.
+// Absolute numbers depend on the build machine; only compare runs made
+// on the same one. Run with: pio test -e native -f test_benchmark -v
+#include <stdio.h>
+#include <chrono>
+#include <unity.h>
+#include "wordclock_core.h"
+#include "../reference_frames.h"
+
+#define BENCH_ROUNDS 200
+
+volatile FrameMask frameSink;
+volatile int32_t offsetSink;
+volatile uint8_t brightnessSink;
+
+void setUp() {}
+void tearDown() {}
+
+template <typename F>
+double nsPerCall(long calls, F body) {
+    auto started = std::chrono::steady_clock::now();
+    body();
+    auto elapsed = std::chrono::steady_clock::now() - started;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / calls;
+}
+
+void report(const char* name, double ns) {
+    char message[80];
+    snprintf(message, sizeof(message), "%-28s %9.2f ns", name, ns);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_TRUE(ns > 0);
+}
+
+// One frame per minute of the day, from the LUTs
+void test_bench_frame() {
+    double ns = nsPerCall(BENCH_ROUNDS * 1440L, []() {
+        for (int round = 0; round < BENCH_ROUNDS; round++) {
+            for (int hour = 0; hour < 24; hour++) {
+                for (int minute = 0; minute < 60; minute++) frameSink = faceFrame(BUILTIN_FACE, hour, minute);
+            }
+        }
+    });
+    report("frame (LUT)", ns);
+}
+
+// The same frames built word by word from the phrase text
+void test_bench_frame_reference() {
+    double ns = nsPerCall(BENCH_ROUNDS * 1440L, []() {
+        for (int round = 0; round < BENCH_ROUNDS; round++) {
+            for (int hour = 0; hour < 24; hour++) {
+                for (int minute = 0; minute < 60; minute++) frameSink = referenceFrame(hour, minute);
+            }
+        }
+    });
+    report("frame (word by word)", ns);
+}
+
+// Current estimate and limit for one frame, as core 1 does for each one
+void test_bench_power_limit() {
+    double ns = nsPerCall(BENCH_ROUNDS * 1440L, []() {
+        for (int round = 0; round < BENCH_ROUNDS; round++) {
+            for (int minute = 0; minute < 1440; minute++) {
+                FrameMask frame = faceFrame(BUILTIN_FACE, minute / 60, minute % 60);
+                uint32_t load = frameLoadUa(frame, BUILTIN_FACE.alwaysOn, 36000 - round, 21000);
+                brightnessSink = powerLimitBrightness(255 - (minute & 63), load, 600000);
+            }
+        }
+    });
+    report("frame + power limit", ns);
+}
+
+// Every minute of a year through the cached offset, as the firmware does
+void test_bench_offset_cached() {
+    TzState state = {};
+    tzParse("CET-1CEST,M3.5.0,M10.5.0/3", state.rule);
+    int64_t from = daysFromCivil(2026, 1, 1) * 86400LL;
+    long minutes = 366L * 1440;
+    double ns = nsPerCall(minutes, [&]() {
+        for (long i = 0; i < minutes; i++) {
+            int64_t utc = from + i * 60;
+            if (utc >= state.validUntil || utc < state.validFrom) tzUpdate(state, utc);
+            offsetSink = state.offset;
+        }
+    });
+    report("tz offset (cached)", ns);
+}
+
+// Full recomputation, the cost paid once per transition
+void test_bench_offset_update() {
+    TzState state = {};
+    tzParse("CET-1CEST,M3.5.0,M10.5.0/3", state.rule);
+    int64_t from = daysFromCivil(2026, 1, 1) * 86400LL;
+    long calls = 100000;
+    double ns = nsPerCall(calls, [&]() {
+        for (long i = 0; i < calls; i++) {
+            tzUpdate(state, from + i * 317);
+            offsetSink = state.offset;
+        }
+    });
+    report("tz offset (update)", ns);
+}
+
+// UTC seconds to a local frame, without any caching of the date
+void test_bench_time_to_frame() {
+    TzState state = {};
+    tzParse("CET-1CEST,M3.5.0,M10.5.0/3", state.rule);
+    int64_t from = daysFromCivil(2026, 1, 1) * 86400LL;
+    long minutes = 366L * 1440;
+    double ns = nsPerCall(minutes, [&]() {
+        for (long i = 0; i < minutes; i++) {
+            int64_t utc = from + i * 60;
+            if (utc >= state.validUntil || utc < state.validFrom) tzUpdate(state, utc);
+            int64_t local = utc + state.offset;
+            int32_t year, month, day;
+            civilFromDays((int32_t)(local / 86400), year, month, day);
+            int32_t seconds = local % 86400;
+            frameSink = faceFrame(BUILTIN_FACE, seconds / 3600, seconds / 60 % 60) ^ (FrameMask)(day + month + year);
+        }
+    });
+    report("utc -> local -> frame", ns);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_bench_frame);
+    RUN_TEST(test_bench_frame_reference);
+    RUN_TEST(test_bench_power_limit);
+    RUN_TEST(test_bench_offset_cached);
+    RUN_TEST(test_bench_offset_update);
+    RUN_TEST(test_bench_time_to_frame);
+    return UNITY_END();
+}
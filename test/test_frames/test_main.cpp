@@ -0,0 +1,60 @@
+// Every minute of the day on the built-in face against the written-out
+// reference. Run with: pio test -e native
+#include <stdio.h>
+#include <unity.h>
+#include "wordclock_core.h"
+#include "../reference_frames.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_every_minute_matches_reference() {
+    for (int hour = 0; hour < 24; hour++) {
+        for (int minute = 0; minute < 60; minute++) {
+            char message[48];
+            snprintf(message, sizeof(message), "%02d:%02d \"%s\"", hour, minute, MINUTE_PHRASES[minute]);
+            TEST_ASSERT_EQUAL_HEX64_MESSAGE(referenceFrame(hour, minute), faceFrame(BUILTIN_FACE, hour, minute), message);
+        }
+    }
+}
+
+void test_frames_stay_on_the_face() {
+    for (int hour = 0; hour < 24; hour++) {
+        for (int minute = 0; minute < 60; minute++) {
+            FrameMask frame = faceFrame(BUILTIN_FACE, hour, minute);
+            TEST_ASSERT_EQUAL_HEX64(0, frame & ~BUILTIN_FACE.all);
+            TEST_ASSERT_EQUAL_HEX64(BUILTIN_FACE.alwaysOn, frame & BUILTIN_FACE.alwaysOn);
+        }
+    }
+}
+
+void test_exactly_one_hour_word() {
+    FrameMask hourWords = 0;
+    for (int h = 0; h < 12; h++) hourWords |= BUILTIN_FACE.hours[h];
+    
+    for (int hour = 0; hour < 24; hour++) {
+        for (int minute = 0; minute < 60; minute++) {
+            FrameMask lit = faceFrame(BUILTIN_FACE, hour, minute) & hourWords;
+            int matches = 0;
+            for (int h = 0; h < 12; h++) matches += lit == BUILTIN_FACE.hours[h];
+            TEST_ASSERT_EQUAL(1, matches);
+        }
+    }
+}
+
+void test_am_pm_follows_the_named_hour() {
+    // 11:17 still names elf, 11:18 already names twaalf in the afternoon
+    TEST_ASSERT_TRUE(faceFrame(BUILTIN_FACE, 11, 17) & BUILTIN_FACE.am);
+    TEST_ASSERT_TRUE(faceFrame(BUILTIN_FACE, 11, 18) & BUILTIN_FACE.pm);
+    TEST_ASSERT_TRUE(faceFrame(BUILTIN_FACE, 23, 18) & BUILTIN_FACE.am);
+    TEST_ASSERT_EQUAL_HEX64(BUILTIN_FACE.hours[0], faceFrame(BUILTIN_FACE, 23, 45) & BUILTIN_FACE.hours[0]);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_every_minute_matches_reference);
+    RUN_TEST(test_frames_stay_on_the_face);
+    RUN_TEST(test_exactly_one_hour_word);
+    RUN_TEST(test_am_pm_follows_the_named_hour);
+    return UNITY_END();
+}
@@ -0,0 +1,73 @@
+// Power model and limiter against brute force: the limited brightness is
+// the highest one whose scaled load fits the budget. Run with:
+// pio test -e native -f test_power
+#include <stdio.h>
+#include <unity.h>
+#include "wordclock_core.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_load_counts_each_group() {
+    FrameMask alwaysOn = BUILTIN_FACE.alwaysOn;
+    TEST_ASSERT_EQUAL_UINT32(0, frameLoadUa(0, alwaysOn, 1000, 10));
+    TEST_ASSERT_EQUAL_UINT32(5 * 10, frameLoadUa(alwaysOn, alwaysOn, 1000, 10));
+    TEST_ASSERT_EQUAL_UINT32(56 * 1000, frameLoadUa(BUILTIN_FACE.all, 0, 1000, 10));
+    TEST_ASSERT_EQUAL_UINT32(51 * 1000 + 5 * 10, frameLoadUa(BUILTIN_FACE.all, alwaysOn, 1000, 10));
+    TEST_ASSERT_EQUAL_UINT32(64 * 36000, frameLoadUa(~FrameMask(0), 0, 36000, 0));
+}
+
+void test_load_matches_lit_leds() {
+    for (int hour = 0; hour < 24; hour++) {
+        for (int minute = 0; minute < 60; minute++) {
+            FrameMask frame = faceFrame(BUILTIN_FACE, hour, minute);
+            uint32_t expected = 0;
+            for (int i = 0; i < BUILTIN_FACE_LEDS; i++) {
+                if (!((frame >> i) & 1)) continue;
+                expected += ((BUILTIN_FACE.alwaysOn >> i) & 1) ? 700 : 3000;
+            }
+            TEST_ASSERT_EQUAL_UINT32(expected, frameLoadUa(frame, BUILTIN_FACE.alwaysOn, 3000, 700));
+        }
+    }
+}
+
+void test_within_budget_passes_through() {
+    TEST_ASSERT_EQUAL_UINT8(255, powerLimitBrightness(255, 1000000, 1000000));
+    TEST_ASSERT_EQUAL_UINT8(64, powerLimitBrightness(64, 3900000, 1000000));
+    TEST_ASSERT_EQUAL_UINT8(200, powerLimitBrightness(200, 0, 0));
+}
+
+void test_limit_is_highest_within_budget() {
+    for (uint32_t load = 1; load < 20000000; load = load * 3 / 2 + 7) {
+        for (uint32_t budget = 0; budget < 3000000; budget = budget * 5 / 4 + 13) {
+            for (int brightness = 0; brightness < 256; brightness += 5) {
+                uint8_t limited = powerLimitBrightness(brightness, load, budget);
+                char message[64];
+                snprintf(message, sizeof(message), "load %lu budget %lu brightness %d",
+                         (unsigned long)load, (unsigned long)budget, brightness);
+                TEST_ASSERT_TRUE_MESSAGE(limited <= brightness, message);
+                if (limited > 0) TEST_ASSERT_TRUE_MESSAGE(scaledLoadUa(load, limited) <= budget, message);
+                if (limited < brightness) TEST_ASSERT_TRUE_MESSAGE(scaledLoadUa(load, limited + 1) > budget, message);
+            }
+        }
+    }
+}
+
+void test_full_white_face_on_a_small_supply() {
+    // 56 LEDs at 3 x 12 mA: just over 2 A, into a 1 A budget
+    uint32_t load = frameLoadUa(BUILTIN_FACE.all, 0, 36000, 36000);
+    uint8_t limited = powerLimitBrightness(255, load, 1000000);
+    TEST_ASSERT_TRUE(scaledLoadUa(load, limited) <= 1000000);
+    TEST_ASSERT_TRUE(scaledLoadUa(load, limited) > 990000);
+    TEST_ASSERT_EQUAL_UINT8(126, limited);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_load_counts_each_group);
+    RUN_TEST(test_load_matches_lit_leds);
+    RUN_TEST(test_within_budget_passes_through);
+    RUN_TEST(test_limit_is_highest_within_budget);
+    RUN_TEST(test_full_white_face_on_a_small_supply);
+    return UNITY_END();
+}
@@ -0,0 +1,195 @@
+// POSIX TZ engine against published DST dates, and every minute of each
+// transition day through to the frame on the face. The calendar maths
+// of the reference comes from the host C library, not from the engine.
+#include <stdio.h>
+#include <time.h>
+#include <unity.h>
+#include "wordclock_core.h"
+#include "../reference_frames.h"
+
+struct DstDates {
+    int year;
+    int startDay;   // Day of the month DST starts
+    int endDay;     // Day of the month DST ends
+};
+
+// Last Sunday of March and October
+static const DstDates EU_DATES[] = {
+    {2000, 26, 29}, {2001, 25, 28}, {2002, 31, 27}, {2003, 30, 26}, {2004, 28, 31},
+    {2005, 27, 30}, {2006, 26, 29}, {2007, 25, 28}, {2008, 30, 26}, {2009, 29, 25},
+    {2010, 28, 31}, {2011, 27, 30}, {2012, 25, 28}, {2013, 31, 27}, {2014, 30, 26},
+    {2015, 29, 25}, {2016, 27, 30}, {2017, 26, 29}, {2018, 25, 28}, {2019, 31, 27},
+    {2020, 29, 25}, {2021, 28, 31}, {2022, 27, 30}, {2023, 26, 29}, {2024, 31, 27},
+    {2025, 30, 26}, {2026, 29, 25}, {2027, 28, 31}, {2028, 26, 29}, {2029, 25, 28},
+    {2030, 31, 27}, {2031, 30, 26}, {2032, 28, 31}, {2033, 27, 30}, {2034, 26, 29},
+    {2035, 25, 28}, {2036, 30, 26}, {2037, 29, 25}, {2038, 28, 31}, {2039, 27, 30},
+};
+
+// Second Sunday of March, first Sunday of November
+static const DstDates US_DATES[] = {
+    {2007, 11, 4}, {2008, 9, 2}, {2009, 8, 1}, {2010, 14, 7}, {2011, 13, 6},
+    {2012, 11, 4}, {2013, 10, 3}, {2014, 9, 2}, {2015, 8, 1}, {2016, 13, 6},
+    {2017, 12, 5}, {2018, 11, 4}, {2019, 10, 3}, {2020, 8, 1}, {2021, 14, 7},
+    {2022, 13, 6}, {2023, 12, 5}, {2024, 10, 3}, {2025, 9, 2}, {2026, 8, 1},
+    {2027, 14, 7}, {2028, 12, 5}, {2029, 11, 4}, {2030, 10, 3}, {2031, 9, 2},
+    {2032, 14, 7}, {2033, 13, 6}, {2034, 12, 5}, {2035, 11, 4}, {2036, 9, 2},
+    {2037, 8, 1}, {2038, 14, 7}, {2039, 13, 6},
+};
+
+struct Zone {
+    const char* spec;
+    int32_t stdOffset;
+    int32_t dstOffset;
+    int startMonth;
+    int endMonth;
+    int32_t startUtc;   // Seconds after UTC midnight of the given day
+    int32_t endUtc;
+    const DstDates* dates;
+    size_t count;
+};
+
+static const Zone ZONES[] = {
+    {"CET-1CEST,M3.5.0,M10.5.0/3", 3600, 7200, 3, 10, 3600, 3600, EU_DATES, sizeof(EU_DATES) / sizeof(EU_DATES[0])},
+    {"EST5EDT,M3.2.0,M11.1.0", -18000, -14400, 3, 11, 7 * 3600, 6 * 3600, US_DATES, sizeof(US_DATES) / sizeof(US_DATES[0])},
+};
+
+void setUp() {}
+void tearDown() {}
+
+int64_t referenceUtc(int year, int month, int day) {
+    struct tm t = {};
+    t.tm_year = year - 1900;
+    t.tm_mon = month - 1;
+    t.tm_mday = day;
+    return (int64_t)timegm(&t);
+}
+
+TzState stateFor(const char* spec) {
+    TzState state = {};
+    TEST_ASSERT_TRUE_MESSAGE(tzParse(spec, state.rule), spec);
+    state.validFrom = 0;
+    state.validUntil = 0;
+    return state;
+}
+
+// Same check as tzOffsetAt() in the firmware
+int32_t cachedOffset(TzState& state, int64_t utc) {
+    if (utc >= state.validUntil || utc < state.validFrom) tzUpdate(state, utc);
+    return state.offset;
+}
+
+void checkTransitionDay(const Zone& zone, TzState& cached, const DstDates& dates, int month, int day) {
+    int year = dates.year;
+    int64_t midnight = referenceUtc(year, month, day);
+    int64_t start = referenceUtc(year, zone.startMonth, dates.startDay) + zone.startUtc;
+    int64_t end = referenceUtc(year, zone.endMonth, dates.endDay) + zone.endUtc;
+    
+    for (int minute = 0; minute < 1440; minute++) {
+        int64_t utc = midnight + minute * 60;
+        int32_t expected = (utc >= start && utc < end) ? zone.dstOffset : zone.stdOffset;
+        
+        TzState fresh = stateFor(zone.spec);
+        tzUpdate(fresh, utc);
+        char message[64];
+        snprintf(message, sizeof(message), "%s %04d-%02d-%02d +%d min", zone.spec, year, month, day, minute);
+        TEST_ASSERT_EQUAL_INT32_MESSAGE(expected, fresh.offset, message);
+        TEST_ASSERT_EQUAL_INT32_MESSAGE(expected, cachedOffset(cached, utc), message);
+        
+        time_t local = (time_t)(utc + expected);
+        struct tm t;
+        gmtime_r(&local, &t);
+        FrameMask frame = faceFrame(BUILTIN_FACE, t.tm_hour, t.tm_min);
+        TEST_ASSERT_EQUAL_HEX64_MESSAGE(referenceFrame(t.tm_hour, t.tm_min), frame, message);
+    }
+}
+
+void test_every_minute_of_every_transition_day() {
+    for (const Zone& zone : ZONES) {
+        TzState cached = stateFor(zone.spec);
+        for (const DstDates* d = zone.dates; d < zone.dates + zone.count; d++) {
+            checkTransitionDay(zone, cached, *d, zone.startMonth, d->startDay);
+            checkTransitionDay(zone, cached, *d, zone.endMonth, d->endDay);
+        }
+    }
+}
+
+void test_offsets_between_transitions() {
+    for (const Zone& zone : ZONES) {
+        TzState cached = stateFor(zone.spec);
+        for (const DstDates* d = zone.dates; d < zone.dates + zone.count; d++) {
+            int64_t start = referenceUtc(d->year, zone.startMonth, d->startDay) + zone.startUtc;
+            int64_t end = referenceUtc(d->year, zone.endMonth, d->endDay) + zone.endUtc;
+            TEST_ASSERT_EQUAL_INT32(zone.stdOffset, cachedOffset(cached, start - 1));
+            TEST_ASSERT_EQUAL_INT32(zone.dstOffset, cachedOffset(cached, start));
+            TEST_ASSERT_EQUAL_INT32(zone.dstOffset, cachedOffset(cached, end - 1));
+            TEST_ASSERT_EQUAL_INT32(zone.stdOffset, cachedOffset(cached, end));
+            TEST_ASSERT_EQUAL_INT32(zone.stdOffset, cachedOffset(cached, referenceUtc(d->year, 1, 15)));
+            TEST_ASSERT_EQUAL_INT32(zone.dstOffset, cachedOffset(cached, referenceUtc(d->year, 7, 15)));
+        }
+    }
+}
+
+void test_southern_hemisphere() {
+    // Sydney 2024: DST ended 7 April 03:00 local, started 6 October 02:00 local
+    TzState state = stateFor("AEST-10AEDT,M10.1.0,M4.1.0/3");
+    int64_t end = referenceUtc(2024, 4, 6) + 16 * 3600;
+    int64_t start = referenceUtc(2024, 10, 5) + 16 * 3600;
+    TEST_ASSERT_EQUAL_INT32(39600, cachedOffset(state, referenceUtc(2024, 1, 1)));
+    TEST_ASSERT_EQUAL_INT32(39600, cachedOffset(state, end - 1));
+    TEST_ASSERT_EQUAL_INT32(36000, cachedOffset(state, end));
+    TEST_ASSERT_EQUAL_INT32(36000, cachedOffset(state, start - 1));
+    TEST_ASSERT_EQUAL_INT32(39600, cachedOffset(state, start));
+}
+
+void test_rule_syntax() {
+    TzRule rule;
+    TEST_ASSERT_TRUE(tzParse("UTC0", rule));
+    TEST_ASSERT_FALSE(rule.hasDst);
+    TEST_ASSERT_TRUE(tzParse("<+0530>-5:30", rule));
+    TEST_ASSERT_EQUAL_INT32(19800, rule.stdOffset);
+    TEST_ASSERT_TRUE(tzParse("IST-5:30", rule));
+    TEST_ASSERT_EQUAL_INT32(19800, rule.stdOffset);
+    TEST_ASSERT_TRUE(tzParse("XXX3YYY,J60,J300", rule));
+    TEST_ASSERT_EQUAL(TZ_RULE_JULIAN, rule.start.kind);
+    TEST_ASSERT_TRUE(tzParse("XXX3YYY,59,299/1:30", rule));
+    TEST_ASSERT_EQUAL(TZ_RULE_DAY, rule.start.kind);
+    TEST_ASSERT_EQUAL_INT32(5400, rule.end.time);
+    
+    TEST_ASSERT_FALSE(tzParse("", rule));
+    TEST_ASSERT_FALSE(tzParse("CET", rule));
+    TEST_ASSERT_FALSE(tzParse("CET-1CEST", rule));
+    TEST_ASSERT_FALSE(tzParse("CET-1CEST,M13.5.0,M10.5.0", rule));
+    TEST_ASSERT_FALSE(tzParse("CET-1CEST,M3.5.0", rule));
+    TEST_ASSERT_FALSE(tzParse("CET-1CEST,M3.5.0,M10.5.0/3x", rule));
+}
+
+void test_julian_days_skip_february_29() {
+    // Jn never counts February 29, n always does
+    TzTransition julian = {TZ_RULE_JULIAN, 0, 0, 60, 0};
+    TzTransition counted = {TZ_RULE_DAY, 0, 0, 59, 0};
+    TEST_ASSERT_EQUAL_INT32(referenceUtc(2024, 3, 1) / 86400, tzTransitionDay(julian, 2024));
+    TEST_ASSERT_EQUAL_INT32(referenceUtc(2024, 2, 29) / 86400, tzTransitionDay(counted, 2024));
+    TEST_ASSERT_EQUAL_INT32(referenceUtc(2023, 3, 1) / 86400, tzTransitionDay(julian, 2023));
+}
+
+void test_civil_dates_round_trip() {
+    for (int32_t days = -800000; days <= 800000; days += 7) {
+        int32_t year, month, day;
+        civilFromDays(days, year, month, day);
+        TEST_ASSERT_EQUAL_INT32(days, daysFromCivil(year, month, day));
+    }
+    for (int year = 1970; year < 2100; year++) {
+        TEST_ASSERT_EQUAL_INT32(referenceUtc(year, 3, 1) / 86400, daysFromCivil(year, 3, 1));
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_every_minute_of_every_transition_day);
+    RUN_TEST(test_offsets_between_transitions);
+    RUN_TEST(test_southern_hemisphere);
+    RUN_TEST(test_rule_syntax);
+    RUN_TEST(test_julian_days_skip_february_29);
+    RUN_TEST(test_civil_dates_round_trip);
+    return UNITY_END();
+}
@@ -0,0 +1,56 @@
+"""Packs web/ into gzip files in data/www/ for the LittleFS image.
+
+Runs as a PlatformIO pre-script on every build, so `pio run -t uploadfs`
+always ships the current pages. References to the stylesheet and script
+in index.html get a content hash, which lets the browser cache those for
+good; index.html itself is revalidated through its ETag. The output is
+reproducible (no timestamp in the gzip header), so an unchanged asset
+keeps its ETag across builds.
+"""
+
+import gzip
+import hashlib
+import os
+
+SOURCE = "web"
+TARGET = os.path.join("data", "www")
+VERSIONED = ["app.css", "app.js"]   # Must match WEB_ASSETS in src/main.cpp
+
+
+def pack(project_dir):
+    source = os.path.join(project_dir, SOURCE)
+    target = os.path.join(project_dir, TARGET)
+    os.makedirs(target, exist_ok=True)
+
+    def read(name):
+        with open(os.path.join(source, name), "rb") as f:
+            return f.read()
+
+    def write(name, data):
+        packed = gzip.compress(data, compresslevel=9, mtime=0)
+        path = os.path.join(target, name + ".gz")
+        # Leave the file alone when nothing changed, so the image is not rebuilt
+        if os.path.exists(path):
+            with open(path, "rb") as f:
+                if f.read() == packed:
+                    return len(data), len(packed)
+        with open(path, "wb") as f:
+            f.write(packed)
+        return len(data), len(packed)
+
+    page = read("index.html")
+    for name in VERSIONED:
+        data = read(name)
+        version = hashlib.sha1(data).hexdigest()[:8]
+        page = page.replace(f'"/{name}"'.encode(), f'"/{name}?v={version}"'.encode())
+        raw, packed = write(name, data)
+        print(f"web: {name} {raw} -> {packed} bytes")
+    raw, packed = write("index.html", page)
+    print(f"web: index.html {raw} -> {packed} bytes")
+
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO
+    pack(env["PROJECT_DIR"])  # noqa: F821
+except NameError:
+    pack(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+"""Decodes the binary trace events from the clock's log port.
+
+Trace frames (see traceSend() in src/main.cpp) are interleaved with the
+normal text log; text is passed through unchanged.
+
+    tools/trace_decode.py --port /dev/ttyACM0 --level 2
+    tools/trace_decode.py capture.bin
+"""
+
+import argparse
+import struct
+import sys
+
+SYNC = b"\xa5\x5a"
+FRAME_SIZE = 15
+
+# Must match TraceEventType
+EVENTS = [
+    "dropped",
+    "frame_published",
+    "frame_shown",
+    "ntp_sent",
+    "ntp_received",
+    "ntp_failed",
+    "http_request",
+    "flash_commit",
+    "button_edge",
+    "wifi_link",
+    "ota",
+    "lan_role",
+    "lan_beacon",
+    "task_overrun",
+]
+
+OTA_STAGES = ["start", "staged", "failed", "rollback"]
+LAN_ROLES = ["off", "listening", "follower", "leader"]
+# Must match the order of tasks[]
+TASKS = ["network", "time_sync", "button", "config", "display", "wifi", "brightness",
+         "animation", "scan", "snapshot", "ota", "trace"]
+
+
+def describe(kind, arg0, arg1):
+    if kind == "dropped":
+        return f"{arg1} events lost"
+    if kind == "frame_shown":
+        return f"transition={arg0}"
+    if kind == "ntp_received":
+        offset = arg1 - (1 << 32) if arg1 & 0x80000000 else arg1
+        return f"offset={offset / 1000:.3f} ms"
+    if kind == "http_request":
+        return f"route={arg0} {arg1 / 1000:.3f} ms"
+    if kind == "flash_commit":
+        return f"{'erase+' if arg0 else ''}program {arg1 / 1000:.3f} ms"
+    if kind == "button_edge":
+        return "released" if arg0 else "pressed"
+    if kind == "wifi_link":
+        return "up" if arg0 else "down"
+    if kind == "ota":
+        stage = OTA_STAGES[arg0] if arg0 < len(OTA_STAGES) else arg0
+        return f"{stage} {arg1} bytes"
+    if kind == "lan_role":
+        return LAN_ROLES[arg0] if arg0 < len(LAN_ROLES) else str(arg0)
+    if kind == "lan_beacon":
+        if arg0 == 0:
+            return "sent"
+        error = arg1 - (1 << 32) if arg1 & 0x80000000 else arg1
+        return f"applied, error={error / 1000:.3f} ms"
+    if kind == "task_overrun":
+        task = TASKS[arg0] if arg0 < len(TASKS) else str(arg0)
+        return f"{task} {arg1 / 1000:.3f} ms"
+    return ""
+
+
+class Decoder:
+    def __init__(self, out):
+        self.out = out
+        self.buffer = bytearray()
+        self.text = bytearray()
+        self.last = None            # Newest raw timestamp, for unwrapping
+        self.high = 0
+        self.origin = None
+
+    # Both cores stamp from the same 32-bit timer, but the rings are drained
+    # one after the other, so events arrive slightly out of order. Only a
+    # jump of more than half the range counts as a wrap.
+    def timestamp(self, raw):
+        high = self.high
+        if self.last is not None:
+            if self.last - raw > 1 << 31:
+                self.high += 1 << 32
+                high = self.high
+                self.last = raw
+            elif raw - self.last > 1 << 31:
+                high -= 1 << 32     # From before the last wrap
+            elif raw > self.last:
+                self.last = raw
+        else:
+            self.last = raw
+        us = high + raw
+        if self.origin is None:
+            self.origin = us
+        return us - self.origin
+
+    def flush_text(self):
+        if self.text:
+            self.out.write(self.text.decode("utf-8", "replace"))
+            self.text.clear()
+
+    def feed(self, data):
+        self.buffer += data
+        while self.buffer:
+            start = self.buffer.find(SYNC)
+            if start < 0:
+                # Keep a trailing 0xA5 in case the sync is split
+                keep = 1 if self.buffer[-1:] == SYNC[:1] else 0
+                self.text += self.buffer[:len(self.buffer) - keep]
+                del self.buffer[:len(self.buffer) - keep]
+                break
+            self.text += self.buffer[:start]
+            del self.buffer[:start]
+            if len(self.buffer) < FRAME_SIZE:
+                break
+
+            frame = bytes(self.buffer[:FRAME_SIZE])
+            check = 0
+            for b in frame[2:-1]:
+                check ^= b
+            kind_id, core, arg0, raw, arg1 = struct.unpack_from("<BBHII", frame, 2)
+            if check != frame[-1] or core > 1 or kind_id >= len(EVENTS):
+                # Not a frame after all
+                self.text += self.buffer[:1]
+                del self.buffer[:1]
+                continue
+            del self.buffer[:FRAME_SIZE]
+
+            self.flush_text()
+            kind = EVENTS[kind_id]
+            us = self.timestamp(raw)
+            self.out.write(f"[{us / 1e6:12.6f}] core{core} {kind:<16} {describe(kind, arg0, arg1)}\n")
+        self.flush_text()
+        self.out.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", nargs="?", help="raw capture file, - for stdin")
+    parser.add_argument("--port", help="serial port of the clock")
+    parser.add_argument("--baud", type=int, default=921600)
+    parser.add_argument("--level", type=int, choices=range(10), help="set the trace level first")
+    args = parser.parse_args()
+
+    decoder = Decoder(sys.stdout)
+    if args.port:
+        import serial  # pyserial
+
+        with serial.Serial(args.port, args.baud, timeout=0.1) as port:
+            if args.level is not None:
+                port.write(f"L{args.level}\n".encode())
+            try:
+                while True:
+                    decoder.feed(port.read(4096))
+            except KeyboardInterrupt:
+                pass
+    elif args.capture:
+        stream = sys.stdin.buffer if args.capture == "-" else open(args.capture, "rb")
+        with stream:
+            while chunk := stream.read(4096):
+                decoder.feed(chunk)
+    else:
+        parser.error("give a capture file or --port")
+
+
+if __name__ == "__main__":
+    main()
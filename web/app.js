@@ -0,0 +1,71 @@
+// Static page logic; everything that changes comes from the JSON API
+const $ = (id) => document.getElementById(id);
+const form = $("config");
+
+function fill(config) {
+    const select = form.transition;
+    select.replaceChildren(...config.transitions.map((name) => new Option(name, name)));
+    for (const key of ["ssid", "timezone", "ntp_server", "transition", "transition_ms", "brightness"]) {
+        form[key].value = config[key];
+    }
+    form.lan_time.checked = config.lan_time;
+    form.password.placeholder = config.configured ? "unchanged" : "none";
+}
+
+function showStatus(s) {
+    const time = s.time ? s.time.slice(11, 16) + (s.synced ? "" : " (estimated)") : "unknown";
+    $("status").textContent = `WiFi: ${s.wifi ? "connected" : "disconnected"} · Time: ${time} · ` +
+        `NTP offset ${s.offset_ms.toFixed(1)} ms · LAN time: ${s.lan_role} · Face: ${s.face}`;
+}
+
+function refreshStatus() {
+    fetch("/api/status").then((r) => r.json()).then(showStatus).catch(() => {});
+}
+
+function showScan(scan) {
+    const list = $("wifi");
+    list.replaceChildren(...scan.networks.map((n) => {
+        const row = document.createElement("div");
+        row.textContent = `${n.ssid} (${n.rssi}dBm)`;
+        row.onclick = () => { form.ssid.value = n.ssid; form.password.focus(); };
+        return row;
+    }));
+    const age = document.createElement("small");
+    age.textContent = scan.age_s < 0 ? "Scanning..." : `Scan age: ${scan.age_s} s`;
+    list.append(age);
+    list.hidden = false;
+    if (scan.age_s < 0) setTimeout(scanWiFi, 2000);
+}
+
+function scanWiFi() {
+    fetch("/api/scan").then((r) => r.json()).then(showScan);
+}
+
+form.onsubmit = (event) => {
+    event.preventDefault();
+    const body = {};
+    for (const key of ["ssid", "timezone", "ntp_server", "transition"]) body[key] = form[key].value;
+    for (const key of ["transition_ms", "brightness"]) body[key] = Number(form[key].value);
+    body.lan_time = form.lan_time.checked;
+    if (form.password.value) body.password = form.password.value;
+    $("result").textContent = "Saving...";
+    fetch("/api/config", {method: "PUT", body: JSON.stringify(body)})
+        .then((r) => r.json())
+        .then((reply) => {
+            if (reply.error) {
+                $("result").textContent = reply.error;
+            } else if (reply.reconnecting) {
+                $("result").textContent = `Joining ${body.ssid}, find the clock there at http://wordclock.local`;
+            } else {
+                $("result").textContent = "Applied";
+                form.password.value = "";
+                refreshStatus();
+            }
+        })
+        .catch(() => { $("result").textContent = "No answer from the clock"; });
+};
+
+$("scan").onclick = scanWiFi;
+fetch("/api/config").then((r) => r.json()).then(fill);
+refreshStatus();
+setInterval(refreshStatus, 30000);